@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host stand-in for the ImGui calls in the shared code. Nothing is drawn, widgets are never activated
+ * and the text buffer keeps what is appended, so logs can still be read back. */
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+
+struct ImVec2 {
+    float x, y;
+    constexpr ImVec2() : x(0.f), y(0.f) { }
+    constexpr ImVec2(float x, float y) : x(x), y(y) { }
+};
+
+struct ImVec4 {
+    float x, y, z, w;
+    constexpr ImVec4() : x(0.f), y(0.f), z(0.f), w(0.f) { }
+    constexpr ImVec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) { }
+};
+
+inline ImVec2 operator-(const ImVec2 &lhs, const ImVec2 &rhs) {
+    return { lhs.x - rhs.x, lhs.y - rhs.y };
+}
+
+inline ImVec2 operator*(const ImVec2 &lhs, float rhs) {
+    return { lhs.x * rhs, lhs.y * rhs };
+}
+
+typedef int ImGuiCol;
+typedef int ImGuiCond;
+typedef int ImGuiWindowFlags;
+
+enum ImGuiCol_ {
+    ImGuiCol_Text,
+};
+
+enum ImGuiCond_ {
+    ImGuiCond_Always       = 1 << 0,
+    ImGuiCond_FirstUseEver = 1 << 2,
+};
+
+enum ImGuiWindowFlags_ {
+    ImGuiWindowFlags_NoCollapse = 1 << 5,
+};
+
+struct ImGuiTextBuffer {
+    std::string Buf;
+
+    const char *begin() const { return this->Buf.data(); }
+    const char *end() const { return this->Buf.data() + this->Buf.size(); }
+    int size() const { return static_cast<int>(this->Buf.size()); }
+    bool empty() const { return this->Buf.empty(); }
+    void clear() { this->Buf.clear(); }
+    const char *c_str() const { return this->Buf.c_str(); }
+
+    void append(const char *str, const char *str_end = nullptr) {
+        this->Buf.append(str, str_end != nullptr ? str_end : str + std::char_traits<char>::length(str));
+    }
+
+    void appendf(const char *fmt, ...) {
+        std::va_list args, copy;
+        va_start(args, fmt);
+        va_copy(copy, args);
+        const int len = std::vsnprintf(nullptr, 0, fmt, copy);
+        va_end(copy);
+        if (len > 0) {
+            const size_t offset = this->Buf.size();
+            this->Buf.resize(offset + len + 1);
+            std::vsnprintf(this->Buf.data() + offset, len + 1, fmt, args);
+            this->Buf.resize(offset + len);
+        }
+        va_end(args);
+    }
+};
+
+namespace ImGui {
+
+inline bool Begin(const char *, bool * = nullptr, ImGuiWindowFlags = 0) { return false; }
+inline void End() { }
+inline bool BeginChild(const char *, const ImVec2 & = ImVec2(), bool = false, ImGuiWindowFlags = 0) { return false; }
+inline void EndChild() { }
+inline void BeginGroup() { }
+inline void EndGroup() { }
+inline void SetNextWindowPos(const ImVec2 &, ImGuiCond = 0) { }
+inline void SetNextWindowSize(const ImVec2 &, ImGuiCond = 0) { }
+inline void SetNextItemWidth(float) { }
+inline void SetCursorPos(const ImVec2 &) { }
+inline ImVec2 GetWindowSize() { return {}; }
+inline float GetFrameHeightWithSpacing() { return 0.f; }
+inline double GetTime() { return 0.0; }
+inline void SameLine(float = 0.f, float = -1.f) { }
+inline void Separator() { }
+inline void Columns(int = 1, const char * = nullptr, bool = true) { }
+inline void NextColumn() { }
+inline void PushStyleColor(ImGuiCol, const ImVec4 &) { }
+inline void PopStyleColor(int = 1) { }
+inline void Text(const char *, ...) { }
+inline void TextUnformatted(const char *, const char * = nullptr) { }
+inline void Image(void *, const ImVec2 &) { }
+inline void ProgressBar(float, const ImVec2 & = ImVec2(-1.f, 0.f), const char * = nullptr) { }
+inline bool Button(const char *, const ImVec2 & = ImVec2()) { return false; }
+inline bool Selectable(const char *, bool = false) { return false; }
+inline bool Checkbox(const char *, bool *) { return false; }
+inline bool SliderInt(const char *, int *, int, int, const char * = "%d") { return false; }
+inline bool SliderFloat(const char *, float *, float, float, const char * = "%.3f") { return false; }
+
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The part of libnx the scan and update code uses, with the same layouts, for building it on Linux.
+ * Sessions, events and async objects are stand-ins implemented in libnx_shim.cpp. There is no system
+ * behind them, every command is answered by the simulator or a recording before it gets dispatched. */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+typedef u32 Result;
+typedef u32 Handle;
+
+#define INVALID_HANDLE ((Handle) 0)
+
+/* result.h */
+#define R_SUCCEEDED(res)   ((res)==0)
+#define R_FAILED(res)      ((res)!=0)
+#define R_MODULE(res)      ((res)&0x1FF)
+#define R_DESCRIPTION(res) (((res)>>9)&0x1FFF)
+#define R_VALUE(res)       ((res)&0x3FFFFF)
+
+#define MAKERESULT(module,description) \
+    ((((module)&0x1FF)) | ((description)&0x1FFF)<<9)
+
+#define KERNELRESULT(description) \
+    MAKERESULT(Module_Kernel, KernelError_##description)
+
+enum {
+    Module_Kernel = 1,
+    Module_Libnx  = 345,
+};
+
+enum {
+    KernelError_TimedOut   = 117,
+    KernelError_Cancelled  = 118,
+    KernelError_OutOfRange = 119,
+};
+
+enum {
+    LibnxError_NotInitialized = 8,
+    LibnxError_NotFound       = 9,
+    LibnxError_IoError        = 10,
+    LibnxError_BadInput       = 11,
+};
+
+/* arm/counter.h, the system counter runs at 19.2MHz. */
+u64 armGetSystemTick(void);
+
+static inline u64 armGetSystemTickFreq(void) {
+    return 19200000;
+}
+
+static inline u64 armNsToTicks(u64 ns) {
+    return (ns * 12) / 625;
+}
+
+static inline u64 armTicksToNs(u64 tick) {
+    return (tick * 625) / 12;
+}
+
+/* kernel/svc.h */
+void svcSleepThread(s64 nano);
+
+/* kernel/event.h */
+typedef struct {
+    Handle revent;
+    Handle wevent;
+    bool autoclear;
+} Event;
+
+void eventLoadRemote(Event *t, Handle handle, bool autoclear);
+Result eventWait(Event *t, u64 timeout);
+void eventClose(Event *t);
+
+/* kernel/wait.h */
+typedef enum {
+    WaiterType_Handle,
+    WaiterType_HandleWithClear,
+} WaiterType;
+
+typedef struct {
+    WaiterType type;
+    Handle handle;
+} Waiter;
+
+static inline Waiter waiterForEvent(Event *e) {
+    Waiter wait_obj;
+    wait_obj.type = e->autoclear ? WaiterType_HandleWithClear : WaiterType_Handle;
+    wait_obj.handle = e->revent;
+    return wait_obj;
+}
+
+Result waitObjects(s32 *idx_out, const Waiter *objects, s32 num_objects, u64 timeout);
+
+/* sf/service.h */
+typedef struct Service {
+    Handle session;
+    u32 own_handle;
+    u32 object_id;
+    u16 pointer_buffer_size;
+} Service;
+
+typedef enum {
+    SfBufferAttr_In              = 1U << 0,
+    SfBufferAttr_Out             = 1U << 1,
+    SfBufferAttr_HipcMapAlias    = 1U << 2,
+    SfBufferAttr_HipcPointer     = 1U << 3,
+    SfBufferAttr_FixedSize       = 1U << 4,
+    SfBufferAttr_HipcAutoSelect  = 1U << 5,
+} SfBufferAttr;
+
+typedef struct SfBufferAttrs {
+    u32 attr0, attr1, attr2, attr3, attr4, attr5, attr6, attr7;
+} SfBufferAttrs;
+
+typedef struct SfBuffer {
+    const void *ptr;
+    size_t size;
+} SfBuffer;
+
+typedef enum SfOutHandleAttr {
+    SfOutHandleAttr_None     = 0,
+    SfOutHandleAttr_HipcCopy = 1,
+    SfOutHandleAttr_HipcMove = 2,
+} SfOutHandleAttr;
+
+typedef struct SfOutHandleAttrs {
+    SfOutHandleAttr attr0, attr1, attr2, attr3, attr4, attr5, attr6, attr7;
+} SfOutHandleAttrs;
+
+typedef struct SfDispatchParams {
+    Handle target_session;
+    u32 context;
+
+    SfBufferAttrs buffer_attrs;
+    SfBuffer buffers[8];
+
+    bool in_send_pid;
+
+    u32 in_num_objects;
+    const Service *in_objects[8];
+
+    u32 in_num_handles;
+    Handle in_handles[8];
+
+    u32 out_num_objects;
+    Service *out_objects;
+    SfOutHandleAttrs out_handle_attrs;
+    Handle *out_handles;
+} SfDispatchParams;
+
+static inline bool serviceIsActive(Service *s) {
+    return s->session != INVALID_HANDLE;
+}
+
+void serviceClose(Service *s);
+Result serviceDispatchImpl(Service *s, u32 request_id, const void *in_data, u32 in_data_size, void *out_data, u32 out_data_size, SfDispatchParams disp);
+
+#define serviceDispatch(_s,_rid,...) \
+    serviceDispatchImpl((_s),(_rid),NULL,0,NULL,0,(SfDispatchParams){ __VA_ARGS__ })
+
+#define serviceDispatchIn(_s,_rid,_in,...) \
+    serviceDispatchImpl((_s),(_rid),&(_in),sizeof(_in),NULL,0,(SfDispatchParams){ __VA_ARGS__ })
+
+#define serviceDispatchOut(_s,_rid,_out,...) \
+    serviceDispatchImpl((_s),(_rid),NULL,0,&(_out),sizeof(_out),(SfDispatchParams){ __VA_ARGS__ })
+
+#define serviceDispatchInOut(_s,_rid,_in,_out,...) \
+    serviceDispatchImpl((_s),(_rid),&(_in),sizeof(_in),&(_out),sizeof(_out),(SfDispatchParams){ __VA_ARGS__ })
+
+/* services/ncm_types.h */
+typedef enum {
+    NcmStorageId_None          = 0,
+    NcmStorageId_Host          = 1,
+    NcmStorageId_GameCard      = 2,
+    NcmStorageId_BuiltInSystem = 3,
+    NcmStorageId_BuiltInUser   = 4,
+    NcmStorageId_SdCard        = 5,
+    NcmStorageId_Any           = 6,
+} NcmStorageId;
+
+typedef enum {
+    NcmContentMetaType_Unknown      = 0x0,
+    NcmContentMetaType_Application  = 0x80,
+    NcmContentMetaType_Patch        = 0x81,
+    NcmContentMetaType_AddOnContent = 0x82,
+    NcmContentMetaType_Delta        = 0x83,
+} NcmContentMetaType;
+
+/* nacp.h */
+typedef struct {
+    char name[0x200];
+    char author[0x100];
+} NacpLanguageEntry;
+
+typedef struct {
+    NacpLanguageEntry lang[16];
+    u8 rest[0x4000 - 16 * sizeof(NacpLanguageEntry)];
+} NacpStruct;
+
+Result nacpGetLanguageEntry(NacpStruct *nacp, NacpLanguageEntry **langentry);
+
+/* services/async.h */
+typedef struct {
+    Service s;
+    Event event;
+} AsyncValue;
+
+typedef struct {
+    Service s;
+    Event event;
+} AsyncResult;
+
+Result asyncValueWait(AsyncValue *a, u64 timeout);
+Result asyncValueGetSize(AsyncValue *a, u64 *size);
+Result asyncValueGet(AsyncValue *a, void *buffer, size_t size);
+Result asyncValueCancel(AsyncValue *a);
+void asyncValueClose(AsyncValue *a);
+
+Result asyncResultWait(AsyncResult *a, u64 timeout);
+Result asyncResultGet(AsyncResult *a);
+Result asyncResultCancel(AsyncResult *a);
+void asyncResultClose(AsyncResult *a);
+
+/* services/avm.h */
+typedef struct {
+    u64 application_id;
+    u32 version;
+    u32 required;
+} AvmVersionListEntry;
+
+typedef struct {
+    u64 application_id;
+    u32 version;
+    u8 reserved[4];
+} AvmRequiredVersionEntry;
+
+typedef struct {
+    Service s;
+} AvmVersionListImporter;
+
+Result avmGetVersionListImporter(AvmVersionListImporter *out);
+Result avmVersionListImporterSetTimestamp(AvmVersionListImporter *srv, u64 timestamp);
+Result avmVersionListImporterSetData(AvmVersionListImporter *srv, const AvmVersionListEntry *entries, u32 count);
+Result avmVersionListImporterFlush(AvmVersionListImporter *srv);
+void avmVersionListImporterClose(AvmVersionListImporter *srv);
+
+/* services/ns.h */
+typedef struct {
+    u64 application_id;
+    u8 type;
+    u8 unk_x09;
+    u8 unk_x0A[6];
+    u8 unk_x10;
+    u8 unk_x11[7];
+} NsApplicationRecord;
+
+typedef struct {
+    u8 meta_type;
+    u8 storageID;
+    u8 unk_x02;
+    u8 padding;
+    u32 version;
+    u64 application_id;
+} NsApplicationContentMetaStatus;
+
+typedef struct {
+    NacpStruct nacp;
+    u8 icon[0x20000];
+} NsApplicationControlData;
+
+typedef enum {
+    NsApplicationControlSource_CacheOnly = 0,
+    NsApplicationControlSource_Storage   = 1,
+    NsApplicationControlSource_StorageOnly = 2,
+} NsApplicationControlSource;
+
+typedef struct {
+    u8 storageID;
+    u8 padding[0x7];
+    u64 sizeApplication;
+    u64 sizePatch;
+    u64 sizeAddOnContent;
+} NsApplicationOccupiedSizeEntity;
+
+typedef struct {
+    NsApplicationOccupiedSizeEntity layout[4];
+} NsApplicationOccupiedSize;
+
+Service *nsGetServiceSession_GetterInterface(void);
+Service *nsGetServiceSession_ApplicationManagerInterface(void);
+Result nsGetApplicationVersionInterface(Service *srv_out);
+
+Result nsListApplicationRecord(NsApplicationRecord *records, s32 count, s32 entry_offset, s32 *out_entrycount);
+Result nsListApplicationContentMetaStatus(u64 application_id, s32 index, NsApplicationContentMetaStatus *list, s32 count, s32 *out_entrycount);
+Result nsGetApplicationControlData(NsApplicationControlSource source, u64 application_id, NsApplicationControlData *buffer, size_t size, u64 *actual_size);
+Result nsCalculateApplicationOccupiedSize(u64 application_id, NsApplicationOccupiedSize *out);
+Result nsGetFreeSpaceSize(NcmStorageId storage_id, s64 *size);
+Result nsRequestUpdateApplication2(AsyncResult *a, u64 application_id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "benchmarks.hpp"
+#include "harness.hpp"
+#include "ipc_trace.hpp"
+#include "ns.h"
+#include "update_queue.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <span>
+#include <vector>
+
+namespace {
+
+constexpr u32 LookupRounds = 64;
+
+/* Command latencies the scan is timed at, as multiples of the configured one in quarters. */
+constexpr int ScanLatencyQuarters[] = { 1, 4, 16 };
+
+/* Titles the update benchmark picks the outdated ones from. */
+constexpr size_t UpdateCandidates = 1024;
+
+/* Wall time of a cold scan with the given number of workers. Every run starts from the same simulator state. */
+double TimeScan(const SimulatorConfig &config, size_t workers) {
+    ResetState();
+    IpcSimulatorConfigure(config);
+
+    const u64 start = armGetSystemTick();
+    VersionList list(workers);
+    WaitForScan(list);
+    return SecondsSince(start);
+}
+
+/* Reads back the patch version like VersionList does once a request finished. */
+void VerifyPatch(UpdateJob &job) {
+    NsApplicationContentMetaStatus statuses[0x10];
+    s32 count = 0;
+    if (R_SUCCEEDED(nsPoolListApplicationContentMetaStatus(job.application_id, 0, statuses, std::size(statuses), &count))) {
+        for (const auto &meta: std::span(statuses, count)) {
+            if (meta.meta_type == NcmContentMetaType_Patch)
+                job.versions.patch = meta.version;
+        }
+    }
+    job.verified = true;
+}
+
+/* Push every title to a fresh queue and wait for it to run empty. */
+UpdateProgress RunUpdates(const SimulatorConfig &config, const std::vector<AvmVersionListEntry> &entries, u32 window, bool bulk, double &seconds) {
+    ResetState();
+    IpcSimulatorConfigure(config);
+
+    UpdateQueue queue(VerifyPatch);
+    queue.SetWindow(window);
+
+    const u64 start = armGetSystemTick();
+    for (const auto &entry: entries)
+        queue.Push(entry.application_id & ~u64(0x800), {}, entry.version, bulk);
+    while (queue.GetProgress().busy)
+        svcSleepThread(1'000'000);
+    seconds = SecondsSince(start);
+    return queue.GetProgress();
+}
+
+}
+
+/* GetAvailableVersion on the sorted list against the linear search it replaced, over a full version list. */
+bool LookupBenchmark(const SimulatorConfig &config) {
+    ResetState();
+    IpcSimulatorConfigure(config);
+
+    VersionList list;
+    WaitForScan(list);
+
+    /* The same list the scan sorted, in the order the system returns it. */
+    std::vector<AvmVersionListEntry> entries(config.version_list_size);
+    u32 count = 0;
+    if (R_FAILED(nsListVersionList(entries.data(), entries.size(), &count)) || count == 0) {
+        std::printf("Lookup benchmark FAILED, no version list\n");
+        return false;
+    }
+    entries.resize(count);
+
+    /* Every listed title, then as many that aren't listed. */
+    std::vector<ApplicationId> ids;
+    for (const auto &entry: entries)
+        ids.push_back(entry.application_id & ~u64(0x800));
+    for (const auto &entry: entries)
+        ids.push_back((entry.application_id & ~u64(0x800)) + 1);
+
+    const auto linear = [&entries](ApplicationId application_id) -> u32 {
+        const u64 patch_id = application_id | 0x800;
+        const auto it = std::find_if(std::cbegin(entries), std::cend(entries), [patch_id](const AvmVersionListEntry &entry) {
+            return entry.application_id == patch_id;
+        });
+        return it != std::cend(entries) ? it->version : 0;
+    };
+
+    u64 linear_sum = 0, indexed_sum = 0;
+    u64 start = armGetSystemTick();
+    for (const auto id: ids)
+        linear_sum += linear(id);
+    const double linear_ns = armTicksToNs(armGetSystemTick() - start) / double(ids.size());
+
+    start = armGetSystemTick();
+    for (u32 round = 0; round < LookupRounds; round++) {
+        for (const auto id: ids)
+            indexed_sum += list.GetAvailableVersion(id);
+    }
+    const double indexed_ns = armTicksToNs(armGetSystemTick() - start) / double(ids.size() * LookupRounds);
+
+    const bool ok = linear_sum * LookupRounds == indexed_sum;
+    std::printf("Lookup benchmark: %u entries, %zu lookups, half of them misses\n", count, ids.size());
+    std::printf("  Linear search: %10.1f ns per lookup\n", linear_ns);
+    std::printf("  Sorted list:   %10.1f ns per lookup, %.0fx faster\n", indexed_ns, linear_ns / indexed_ns);
+    std::printf("Lookup benchmark %s\n", ok ? "passed" : "FAILED, results differ");
+    return ok;
+}
+
+/* Application record enumeration of a scan against fetching one record per call, like the scan used to. */
+bool RecordsBenchmark(const SimulatorConfig &config) {
+    ResetState();
+    IpcSimulatorConfigure(config);
+    IpcTraceReset();
+
+    {
+        VersionList list;
+        WaitForScan(list);
+    }
+    const auto batched = IpcTraceGetTotals(IpcCommand::ListApplicationRecord);
+
+    IpcTraceReset();
+    NsApplicationRecord record;
+    const s32 batch = 1;
+    s32 offset = 0, count = 0, records = 0;
+    while (R_SUCCEEDED(nsPoolListApplicationRecord(&record, batch, offset, &count)) && count != 0) {
+        offset++;
+        records++;
+    }
+    const auto single = IpcTraceGetTotals(IpcCommand::ListApplicationRecord);
+
+    const bool ok = records == config.titles && batched.failures == 0 && batched.calls < single.calls;
+    std::printf("Records benchmark: %d records, %dus per command\n", records, config.latency_us);
+    std::printf("  One per call: %6u calls %8.3fs\n", single.calls, single.total_ns / 1e9);
+    std::printf("  Batched:      %6u calls %8.3fs, %.0fx fewer calls\n", batched.calls, batched.total_ns / 1e9, double(single.calls) / batched.calls);
+    std::printf("Records benchmark %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
+
+/* Wall time of a cold scan on the worker pool against a scan on a single worker, at several latencies. */
+bool ScanBenchmark(const SimulatorConfig &config) {
+    std::printf("Scan benchmark: %d titles, %zu workers\n", config.titles, VersionList::DefaultScanWorkers);
+
+    double speedup = 0.;
+    for (const int quarters: ScanLatencyQuarters) {
+        auto scaled = config;
+        scaled.latency_us = config.latency_us * quarters / 4;
+
+        const double serial = TimeScan(scaled, 1);
+        const double pooled = TimeScan(scaled, VersionList::DefaultScanWorkers);
+
+        speedup = serial / pooled;
+        std::printf("  %5dus per command: %8.3fs on one worker, %8.3fs on the pool, %.2fx faster\n", scaled.latency_us, serial, pooled, speedup);
+    }
+
+    /* With slow commands the waits overlap, the pool has to pay off. */
+    const bool ok = speedup > 1.5;
+    std::printf("Scan benchmark %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
+
+/* Update throughput of the queue for every window size and for the bulk path, with the configured update latency. */
+bool UpdatesBenchmark(const SimulatorConfig &config) {
+    IpcSimulatorConfigure(config);
+
+    std::vector<AvmVersionListEntry> candidates(std::min<size_t>(UpdateCandidates, config.titles));
+    u32 count = 0;
+    if (R_FAILED(nsListVersionList(candidates.data(), candidates.size(), &count)) || count == 0) {
+        std::printf("Updates benchmark FAILED, no version list\n");
+        return false;
+    }
+    candidates.resize(count);
+
+    /* Only outdated titles get queued, the auto updater leaves the others alone. */
+    std::vector<AvmVersionListEntry> entries;
+    for (const auto &entry: candidates) {
+        UpdateJob job = { .application_id = entry.application_id & ~u64(0x800) };
+        VerifyPatch(job);
+        if (job.versions.patch < entry.version)
+            entries.push_back(entry);
+    }
+    count = entries.size();
+
+    std::printf("Updates benchmark: %u titles, %dus per update, %dus per command\n", count, config.update_latency_us, config.latency_us);
+
+    bool ok = true;
+    float first = 0.f, last = 0.f;
+    for (u32 window = 1; window <= UpdateQueue::MaxWindow; window *= 2) {
+        double seconds;
+        const auto progress = RunUpdates(config, entries, window, false, seconds);
+        last = progress.finished / seconds;
+        if (window == 1)
+            first = last;
+        ok = ok && progress.finished == count && progress.failed == 0;
+        std::printf("  Window %u: %8.3fs, %7.1f titles/s, %u failed\n", window, seconds, last, progress.failed);
+    }
+
+    double seconds;
+    const auto progress = RunUpdates(config, entries, 1, true, seconds);
+    ok = ok && progress.finished == count && progress.failed == 0;
+    std::printf("  Bulk:     %8.3fs, %7.1f titles/s, %u failed\n", seconds, progress.finished / seconds, progress.failed);
+
+    ok = ok && last > first * 2;
+    std::printf("Updates benchmark %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
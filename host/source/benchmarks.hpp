@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "ipc_simulator.hpp"
+
+/* Measurements of the scan and update code against the simulated library. True if the results check out. */
+bool LookupBenchmark(const SimulatorConfig &config);
+bool RecordsBenchmark(const SimulatorConfig &config);
+bool ScanBenchmark(const SimulatorConfig &config);
+bool UpdatesBenchmark(const SimulatorConfig &config);
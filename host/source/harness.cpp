@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "harness.hpp"
+#include "file_util.hpp"
+#include "ipc_trace.hpp"
+#include "paths.hpp"
+
+#include <cstdio>
+
+namespace {
+
+constexpr const char *StateFiles[] = {
+    STATE_DIRECTORY "queue.bin",
+    STATE_DIRECTORY "metadata.bin",
+};
+
+}
+
+void ResetState() {
+    CreateParentDirectories(StateFiles[0]);
+    for (const auto path: StateFiles)
+        std::remove(path);
+}
+
+double SecondsSince(u64 start) {
+    return armTicksToNs(armGetSystemTick() - start) / 1e9;
+}
+
+void WaitForScan(VersionList &list) {
+    while (list.IsScanning()) {
+        list.Poll();
+        svcSleepThread(1'000'000);
+    }
+    list.Poll();
+}
+
+void WaitForUpdates(VersionList &list) {
+    /* Requests finish before their patches are installed, wait for those too. */
+    for (auto progress = list.GetUpdateProgress(); progress.busy || progress.installing != 0; progress = list.GetUpdateProgress()) {
+        list.Poll();
+        svcSleepThread(1'000'000);
+    }
+    list.Poll();
+}
+
+void PrintCommands() {
+    for (int i = 0; i < static_cast<int>(IpcCommand::Count); i++) {
+        const auto command = static_cast<IpcCommand>(i);
+        const auto totals = IpcTraceGetTotals(command);
+        if (totals.calls == 0)
+            continue;
+        std::printf("    %-34s %6u calls %5u failed %8.3fs\n", IpcCommandName(command), totals.calls, totals.failures, totals.total_ns / 1e9);
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "version_list.hpp"
+
+/* Start without the journal and cache of the previous run. */
+void ResetState();
+double SecondsSince(u64 start);
+
+/* Poll like the UI does once per frame until the scan or the update queue is done. */
+void WaitForScan(VersionList &list);
+void WaitForUpdates(VersionList &list);
+
+/* Calls, failures and time per command since the last IpcTraceReset. */
+void PrintCommands();
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+#include <functional>
+
+/* Hooks into the libnx stand-ins for answering commands that hand out kernel objects. */
+
+/* Run fn on the timer thread once delay_ns passed. */
+void HostSchedule(u64 delay_ns, std::function<void()> fn);
+
+/* Hand out an async request whose event is signalled once complete ran on the timer thread, after delay_ns.
+ * Its result is what complete returns. Cancelled before then, complete doesn't run. */
+void HostAsyncResultStart(AsyncResult *async, u64 delay_ns, std::function<Result()> complete);
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ipc_simulator.hpp"
+
+#include "host_shim.hpp"
+#include "ipc_trace.hpp"
+#include "ns.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/* Simulated titles live in a range of ids the system doesn't hand out, version list filler right below it. */
+constexpr u64 TitleBase  = 0x01ff000000000000;
+constexpr u64 FillerBase = 0x01fe000000000000;
+constexpr u64 IdMask     = 0xffff000000000000;
+constexpr u32 IdShift    = 13;
+
+constexpr Result ResultNotSimulated = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+constexpr Result ResultInjectedFailure = MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+struct Title {
+    u64 application_id;
+    u32 installed, available, required;
+    u32 add_ons;
+    u64 patch_size;
+};
+
+std::mutex g_mutex;
+SimulatorConfig g_config;
+/* Launch required versions pushed since the last configure, they replace the generated ones. */
+std::unordered_map<u64, u32> g_pushed;
+/* Patch versions installed since the last configure, they replace the generated ones. */
+std::unordered_map<u64, u32> g_updated;
+/* Bumped with every install, the system changes a title's record the same way. */
+std::unordered_map<u64, u8> g_record_generation;
+bool g_auto_update_running = false;
+std::atomic<u64> g_calls = 0;
+
+u64 SplitMix64(u64 x) {
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+float Fraction(u64 bits) {
+    return (bits & 0xffff) / 65536.f;
+}
+
+/* Every property of a title follows from its index, the same library is generated every run. */
+Title MakeTitle(const SimulatorConfig &config, u32 index) {
+    const u64 hash = SplitMix64(index);
+
+    Title title = {};
+    title.application_id = TitleBase | (u64(index) << IdShift);
+    title.installed = ((hash & 0xf) + 1) << 16;
+    title.available = title.installed + (Fraction(hash >> 8) < config.outdated ? 0x10000 : 0);
+    title.required = Fraction(hash >> 24) < config.required_mismatch ? title.installed + 0x10000 : 0;
+    /* The system only requires versions that were released. */
+    title.available = std::max(title.available, title.required);
+    title.add_ons = (hash >> 40) % (config.max_add_ons + 1);
+    title.patch_size = (((hash >> 48) & 0xff) + 1) << 20;
+
+    if (const auto it = g_pushed.find(title.application_id); it != std::end(g_pushed))
+        title.required = it->second;
+    if (const auto it = g_updated.find(title.application_id); it != std::end(g_updated))
+        title.installed = it->second;
+    return title;
+}
+
+/* Called with the lock held. */
+bool FindTitle(const SimulatorConfig &config, u64 application_id, Title &title) {
+    if ((application_id & IdMask) != TitleBase)
+        return false;
+
+    const u64 index = (application_id & ~IdMask) >> IdShift;
+    if (index >= static_cast<u64>(config.titles))
+        return false;
+
+    title = MakeTitle(config, index);
+    return true;
+}
+
+bool InjectFailure(const SimulatorConfig &config) {
+    return Fraction(SplitMix64(g_calls++ ^ 0x5eed)) < config.failure_rate;
+}
+
+/* Runs on the timer thread once an update's time is up. */
+Result InstallUpdate(u64 application_id) {
+    std::scoped_lock lk(g_mutex);
+
+    Title title;
+    if (!FindTitle(g_config, application_id, title))
+        return ResultNotSimulated;
+    if (InjectFailure(g_config))
+        return ResultInjectedFailure;
+
+    g_updated[application_id] = std::max(title.installed, title.available);
+    g_record_generation[application_id]++;
+    return 0;
+}
+
+/* The auto updater works through every outdated title, one at a time. Called with the lock held. */
+void StartAutoUpdate(const SimulatorConfig &config) {
+    if (g_auto_update_running)
+        return;
+
+    std::vector<u64> outdated;
+    for (s32 i = 0; i < config.titles; i++) {
+        const auto title = MakeTitle(config, i);
+        if (title.installed < title.available)
+            outdated.push_back(title.application_id);
+    }
+
+    g_auto_update_running = true;
+    const u64 step_ns = config.update_latency_us * 1'000ull;
+    for (size_t i = 0; i < outdated.size(); i++) {
+        HostSchedule(step_ns * (i + 1), [application_id = outdated[i], last = i + 1 == outdated.size()] {
+            InstallUpdate(application_id);
+            if (last) {
+                std::scoped_lock lk(g_mutex);
+                g_auto_update_running = false;
+            }
+        });
+    }
+    if (outdated.empty())
+        g_auto_update_running = false;
+}
+
+template<typename T>
+std::span<T> OutputList(const IpcBuffers &out) {
+    return { static_cast<T *>(out.buffers[0].data), out.buffers[0].size / sizeof(T) };
+}
+
+template<typename T>
+T Input(const IpcBuffers &in, size_t index = 0) {
+    T value = {};
+    std::memcpy(&value, in.buffers[index].data, std::min(sizeof(T), in.buffers[index].size));
+    return value;
+}
+
+template<typename T>
+void Output(const IpcBuffers &out, size_t index, T value) {
+    std::memcpy(out.buffers[index].data, &value, std::min(sizeof(T), out.buffers[index].size));
+}
+
+/* Called with the lock held. */
+Result Answer(const SimulatorConfig &config, IpcCommand command, const IpcBuffers &in, const IpcBuffers &out) {
+    Title title;
+
+    switch (command) {
+        case IpcCommand::ListApplicationRecord: {
+            const auto records = OutputList<NsApplicationRecord>(out);
+            const s32 offset = Input<s32>(in);
+            s32 count = 0;
+            for (auto &record: records) {
+                if (offset + count >= config.titles)
+                    break;
+                const u64 application_id = TitleBase | (u64(offset + count) << IdShift);
+                record = { .application_id = application_id, .type = NsApplicationRecordType_Installed };
+                if (const auto it = g_record_generation.find(application_id); it != std::end(g_record_generation))
+                    record.unk_x10 = it->second;
+                count++;
+            }
+            Output(out, 1, count);
+            return 0;
+        }
+        case IpcCommand::ListApplicationContentMetaStatus: {
+            struct { s32 index; u32 pad; u64 application_id; } request;
+            request = Input<decltype(request)>(in);
+            if (!FindTitle(config, request.application_id, title))
+                return ResultNotSimulated;
+
+            /* Application, patch, then add-ons. */
+            std::vector<NsApplicationContentMetaStatus> statuses;
+            statuses.push_back({ .meta_type = NcmContentMetaType_Application, .storageID = NcmStorageId_SdCard, .application_id = title.application_id });
+            statuses.push_back({ .meta_type = NcmContentMetaType_Patch, .storageID = NcmStorageId_SdCard, .version = title.installed, .application_id = title.application_id | 0x800 });
+            for (u32 i = 0; i < title.add_ons; i++)
+                statuses.push_back({ .meta_type = NcmContentMetaType_AddOnContent, .storageID = NcmStorageId_SdCard, .application_id = (title.application_id | 0x1000) + i + 1 });
+
+            const auto list = OutputList<NsApplicationContentMetaStatus>(out);
+            s32 count = 0;
+            for (size_t i = std::max(request.index, 0); i < statuses.size() && static_cast<size_t>(count) < list.size(); i++)
+                list[count++] = statuses[i];
+            Output(out, 1, count);
+            return 0;
+        }
+        case IpcCommand::GetApplicationControlData: {
+            if (!FindTitle(config, Input<u64>(in), title))
+                return ResultNotSimulated;
+
+            /* Name only, there is no icon. The buffer starts with the first language entry either way. */
+            auto &nacp = *static_cast<NacpStruct *>(out.buffers[0].data);
+            std::memset(&nacp, 0, sizeof(nacp));
+            std::snprintf(nacp.lang[0].name, sizeof(nacp.lang[0].name), "Simulated %016lX", title.application_id);
+            Output<u64>(out, 1, sizeof(nacp));
+            return 0;
+        }
+        case IpcCommand::CalculateApplicationOccupiedSize: {
+            if (!FindTitle(config, Input<u64>(in), title))
+                return ResultNotSimulated;
+
+            NsApplicationOccupiedSize occupied = {};
+            occupied.layout[0].storageID = NcmStorageId_SdCard;
+            occupied.layout[0].sizeApplication = title.patch_size * 4;
+            occupied.layout[0].sizePatch = title.patch_size;
+            Output(out, 0, occupied);
+            return 0;
+        }
+        case IpcCommand::GetFreeSpaceSize:
+            Output<s64>(out, 0, Input<NcmStorageId>(in) == NcmStorageId_SdCard ? 32ll << 30 : 8ll << 30);
+            return 0;
+        case IpcCommand::GetLaunchRequiredVersion:
+            if (!FindTitle(config, Input<u64>(in), title))
+                return ResultNotSimulated;
+            Output(out, 0, title.required);
+            return 0;
+        case IpcCommand::UpgradeLaunchRequiredVersion:
+        case IpcCommand::PushLaunchVersion: {
+            struct { u32 version; u32 pad; u64 application_id; } request;
+            request = Input<decltype(request)>(in);
+            g_pushed[request.application_id] = request.version;
+            return 0;
+        }
+        case IpcCommand::ListVersionList: {
+            const auto entries = OutputList<AvmVersionListEntry>(out);
+            const size_t size = std::min<size_t>(config.version_list_size, entries.size());
+            u32 count = 0;
+            for (; count < size; count++) {
+                if (count < static_cast<u32>(config.titles)) {
+                    title = MakeTitle(config, count);
+                    entries[count] = { .application_id = title.application_id | 0x800, .version = title.available };
+                } else {
+                    entries[count] = { .application_id = FillerBase | (u64(count) << IdShift) | 0x800, .version = 0x10000 };
+                }
+            }
+            Output(out, 1, count);
+            return 0;
+        }
+        case IpcCommand::ListRequiredVersion: {
+            const auto entries = OutputList<AvmRequiredVersionEntry>(out);
+            u32 count = 0;
+            for (s32 i = 0; i < config.titles && count < entries.size(); i++) {
+                title = MakeTitle(config, i);
+                if (title.required != 0)
+                    entries[count++] = { .application_id = title.application_id, .version = title.required };
+            }
+            Output(out, 1, count);
+            return 0;
+        }
+        case IpcCommand::ListAutoUpdateSchedule:
+            Output<u32>(out, 1, 0);
+            return 0;
+        case IpcCommand::UpdateVersionList:
+        case IpcCommand::RequestVersionList:
+            return 0;
+        case IpcCommand::PerformAutoUpdate:
+            StartAutoUpdate(config);
+            return 0;
+        case IpcCommand::RequestUpdateApplication2: {
+            const u64 application_id = Input<u64>(in);
+            if (!FindTitle(config, application_id, title))
+                return ResultNotSimulated;
+
+            HostAsyncResultStart(static_cast<AsyncResult *>(out.buffers[0].data), config.update_latency_us * 1'000ull, [application_id] {
+                return InstallUpdate(application_id);
+            });
+            return 0;
+        }
+        case IpcCommand::RequestVersionListData:
+            /* The list comes as the server sent it, which is nothing the scan reads. */
+            return ResultNotSimulated;
+        default:
+            return 0;
+    }
+}
+
+}
+
+bool IpcSimulate(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, Result &rc) noexcept {
+    /* Sessions are opened by the libnx stand-ins, only the commands sent on them are simulated. */
+    if (command == IpcCommand::GetApplicationVersionInterface || command == IpcCommand::GetApplicationManagerInterface)
+        return false;
+
+    SimulatorConfig config;
+    {
+        std::scoped_lock lk(g_mutex);
+        config = g_config;
+    }
+
+    if (config.latency_us > 0)
+        svcSleepThread(config.latency_us * 1'000ll);
+
+    if (InjectFailure(config)) {
+        rc = ResultInjectedFailure;
+        return true;
+    }
+
+    std::scoped_lock lk(g_mutex);
+    rc = Answer(config, command, in, out);
+    return true;
+}
+
+void IpcSimulatorConfigure(const SimulatorConfig &config) {
+    std::scoped_lock lk(g_mutex);
+    g_config = config;
+    g_pushed.clear();
+    g_updated.clear();
+    g_record_generation.clear();
+}
+
+SimulatorConfig IpcSimulatorGetConfig() {
+    std::scoped_lock lk(g_mutex);
+    return g_config;
+}
+
+u32 IpcSimulatorGetInstalledUpdates() {
+    std::scoped_lock lk(g_mutex);
+    return g_updated.size();
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+/* Shape of the generated library. Every property of a title follows from its index, the same library is generated every run. */
+struct SimulatorConfig {
+    int titles = 5000;
+    /* Entries in the version list, the ones beyond titles belong to applications that aren't installed. */
+    int version_list_size = 0x4000;
+    int max_add_ons = 2;
+    /* Fraction of titles with a newer version listed. */
+    float outdated = .25f;
+    /* Fraction of titles whose launch required version is above the installed one. */
+    float required_mismatch = .05f;
+    /* Fraction of commands and updates that fail. */
+    float failure_rate = 0.f;
+    /* Time every command takes. */
+    int latency_us = 100;
+    /* Time from an update request, or the auto updater picking a title, until the patch is installed. */
+    int update_latency_us = 20000;
+};
+
+/* Start over with a fresh library, forgetting every update and pushed launch version. */
+void IpcSimulatorConfigure(const SimulatorConfig &config);
+SimulatorConfig IpcSimulatorGetConfig();
+
+/* Patches installed since the last configure, by requests and the auto updater. */
+u32 IpcSimulatorGetInstalledUpdates();
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "host_shim.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+/* Reported by every command that would have to reach the system. */
+constexpr Result ResultNoSystem = MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+constexpr Result ResultCancelled = KERNELRESULT(Cancelled);
+constexpr Result ResultTimedOut = KERNELRESULT(TimedOut);
+
+struct AsyncState {
+    Handle event;
+    Result rc;
+    bool done;
+};
+
+/* Sessions and events are numbers in one table, waits block on one condition variable. */
+struct Kernel {
+    std::mutex mutex;
+    std::condition_variable condvar;
+    Handle next_handle = 1;
+    std::unordered_map<Handle, bool> events;
+    std::unordered_map<Handle, AsyncState> asyncs;
+
+    std::mutex timer_mutex;
+    std::condition_variable timer_condvar;
+    std::multimap<u64, std::function<void()>> timers;
+    bool timer_started = false;
+
+    /* Called with the lock held. */
+    Handle NewHandle() {
+        return this->next_handle++;
+    }
+
+    /* Called with the lock held. */
+    void Signal(Handle event) {
+        if (const auto it = this->events.find(event); it != std::end(this->events))
+            it->second = true;
+        this->condvar.notify_all();
+    }
+
+    void TimerThread() {
+        std::unique_lock lk(this->timer_mutex);
+        while (true) {
+            if (this->timers.empty()) {
+                this->timer_condvar.wait(lk);
+                continue;
+            }
+
+            const auto it = std::begin(this->timers);
+            const u64 now = armGetSystemTick();
+            if (now < it->first) {
+                this->timer_condvar.wait_for(lk, std::chrono::nanoseconds(armTicksToNs(it->first - now)));
+                continue;
+            }
+
+            auto fn = std::move(it->second);
+            this->timers.erase(it);
+            lk.unlock();
+            fn();
+            lk.lock();
+        }
+    }
+};
+
+/* Used from static destructors and detached threads alike. Never destroyed. */
+Kernel &GetKernel() {
+    static Kernel *kernel = new Kernel;
+    return *kernel;
+}
+
+Service OpenSession() {
+    auto &kernel = GetKernel();
+    std::scoped_lock lk(kernel.mutex);
+    return { .session = kernel.NewHandle() };
+}
+
+Result AsyncWait(Event *event, u64 timeout) {
+    return eventWait(event, timeout);
+}
+
+Result AsyncGet(Service *s, Event *event) {
+    if (const Result rc = AsyncWait(event, UINT64_MAX); R_FAILED(rc))
+        return rc;
+
+    auto &kernel = GetKernel();
+    std::scoped_lock lk(kernel.mutex);
+    const auto it = kernel.asyncs.find(s->session);
+    return it != std::end(kernel.asyncs) ? it->second.rc : ResultNoSystem;
+}
+
+Result AsyncCancel(Service *s) {
+    auto &kernel = GetKernel();
+    std::scoped_lock lk(kernel.mutex);
+    const auto it = kernel.asyncs.find(s->session);
+    if (it == std::end(kernel.asyncs))
+        return ResultNoSystem;
+
+    auto &state = it->second;
+    if (!state.done) {
+        state.done = true;
+        state.rc = ResultCancelled;
+        kernel.Signal(state.event);
+    }
+    return 0;
+}
+
+void AsyncClose(Service *s, Event *event) {
+    auto &kernel = GetKernel();
+    {
+        std::scoped_lock lk(kernel.mutex);
+        kernel.asyncs.erase(s->session);
+    }
+    eventClose(event);
+    serviceClose(s);
+}
+
+}
+
+void HostSchedule(u64 delay_ns, std::function<void()> fn) {
+    auto &kernel = GetKernel();
+    {
+        std::scoped_lock lk(kernel.timer_mutex);
+        if (!kernel.timer_started) {
+            std::thread(&Kernel::TimerThread, &kernel).detach();
+            kernel.timer_started = true;
+        }
+        kernel.timers.emplace(armGetSystemTick() + armNsToTicks(delay_ns), std::move(fn));
+    }
+    kernel.timer_condvar.notify_one();
+}
+
+void HostAsyncResultStart(AsyncResult *async, u64 delay_ns, std::function<Result()> complete) {
+    auto &kernel = GetKernel();
+    Handle session, event;
+    {
+        std::scoped_lock lk(kernel.mutex);
+        session = kernel.NewHandle();
+        event = kernel.NewHandle();
+        kernel.events[event] = false;
+        kernel.asyncs[session] = { .event = event };
+    }
+
+    *async = {};
+    async->s.session = session;
+    eventLoadRemote(&async->event, event, false);
+
+    HostSchedule(delay_ns, [session, complete = std::move(complete)] {
+        auto &kernel = GetKernel();
+        {
+            std::scoped_lock lk(kernel.mutex);
+            const auto it = kernel.asyncs.find(session);
+            if (it == std::end(kernel.asyncs) || it->second.done)
+                return;
+        }
+
+        const Result rc = complete();
+
+        std::scoped_lock lk(kernel.mutex);
+        const auto it = kernel.asyncs.find(session);
+        if (it == std::end(kernel.asyncs) || it->second.done)
+            return;
+        it->second.done = true;
+        it->second.rc = rc;
+        kernel.Signal(it->second.event);
+    });
+}
+
+u64 armGetSystemTick(void) {
+    const auto since_start = std::chrono::steady_clock::now().time_since_epoch();
+    return armNsToTicks(std::chrono::duration_cast<std::chrono::nanoseconds>(since_start).count());
+}
+
+void svcSleepThread(s64 nano) {
+    if (nano <= 0)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::nanoseconds(nano));
+}
+
+void eventLoadRemote(Event *t, Handle handle, bool autoclear) {
+    t->revent = handle;
+    t->wevent = INVALID_HANDLE;
+    t->autoclear = autoclear;
+}
+
+Result eventWait(Event *t, u64 timeout) {
+    const Waiter waiter = waiterForEvent(t);
+    s32 index;
+    return waitObjects(&index, &waiter, 1, timeout);
+}
+
+void eventClose(Event *t) {
+    if (t->revent != INVALID_HANDLE) {
+        auto &kernel = GetKernel();
+        std::scoped_lock lk(kernel.mutex);
+        kernel.events.erase(t->revent);
+    }
+    t->revent = INVALID_HANDLE;
+    t->wevent = INVALID_HANDLE;
+}
+
+/* Without objects this only sleeps, like the kernel. Handles that aren't events are never signalled. */
+Result waitObjects(s32 *idx_out, const Waiter *objects, s32 num_objects, u64 timeout) {
+    auto &kernel = GetKernel();
+    std::unique_lock lk(kernel.mutex);
+
+    const auto deadline = timeout == UINT64_MAX
+        ? std::chrono::steady_clock::time_point::max()
+        : std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout);
+
+    while (true) {
+        for (s32 i = 0; i < num_objects; i++) {
+            const auto it = kernel.events.find(objects[i].handle);
+            if (it == std::end(kernel.events) || !it->second)
+                continue;
+
+            if (objects[i].type == WaiterType_HandleWithClear)
+                it->second = false;
+            *idx_out = i;
+            return 0;
+        }
+
+        if (kernel.condvar.wait_until(lk, deadline) == std::cv_status::timeout)
+            return ResultTimedOut;
+    }
+}
+
+void serviceClose(Service *s) {
+    *s = {};
+}
+
+/* Every command is answered before it gets here, only the objects a command hands out are made up. */
+Result serviceDispatchImpl(Service *s, u32, const void *, u32, void *, u32, SfDispatchParams disp) {
+    if (!serviceIsActive(s))
+        return ResultNoSystem;
+
+    if (disp.out_num_objects == 0)
+        return ResultNoSystem;
+
+    for (u32 i = 0; i < disp.out_num_objects; i++)
+        disp.out_objects[i] = OpenSession();
+    return 0;
+}
+
+Result nacpGetLanguageEntry(NacpStruct *nacp, NacpLanguageEntry **langentry) {
+    *langentry = nullptr;
+    for (auto &entry: nacp->lang) {
+        if (entry.name[0] != '\0') {
+            *langentry = &entry;
+            return 0;
+        }
+    }
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+}
+
+Result asyncValueWait(AsyncValue *a, u64 timeout) {
+    return AsyncWait(&a->event, timeout);
+}
+
+Result asyncValueGetSize(AsyncValue *a, u64 *size) {
+    *size = 0;
+    return AsyncGet(&a->s, &a->event);
+}
+
+Result asyncValueGet(AsyncValue *a, void *, size_t) {
+    return AsyncGet(&a->s, &a->event);
+}
+
+Result asyncValueCancel(AsyncValue *a) {
+    return AsyncCancel(&a->s);
+}
+
+void asyncValueClose(AsyncValue *a) {
+    AsyncClose(&a->s, &a->event);
+}
+
+Result asyncResultWait(AsyncResult *a, u64 timeout) {
+    return AsyncWait(&a->event, timeout);
+}
+
+Result asyncResultGet(AsyncResult *a) {
+    return AsyncGet(&a->s, &a->event);
+}
+
+Result asyncResultCancel(AsyncResult *a) {
+    return AsyncCancel(&a->s);
+}
+
+void asyncResultClose(AsyncResult *a) {
+    AsyncClose(&a->s, &a->event);
+}
+
+Result avmGetVersionListImporter(AvmVersionListImporter *) {
+    return ResultNoSystem;
+}
+
+Result avmVersionListImporterSetTimestamp(AvmVersionListImporter *, u64) {
+    return ResultNoSystem;
+}
+
+Result avmVersionListImporterSetData(AvmVersionListImporter *, const AvmVersionListEntry *, u32) {
+    return ResultNoSystem;
+}
+
+Result avmVersionListImporterFlush(AvmVersionListImporter *) {
+    return ResultNoSystem;
+}
+
+void avmVersionListImporterClose(AvmVersionListImporter *srv) {
+    serviceClose(&srv->s);
+}
+
+/* Opened once, like nsInitialize does. */
+Service *nsGetServiceSession_GetterInterface(void) {
+    static Service getter = OpenSession();
+    return &getter;
+}
+
+Service *nsGetServiceSession_ApplicationManagerInterface(void) {
+    static Service manager = OpenSession();
+    return &manager;
+}
+
+Result nsGetApplicationVersionInterface(Service *srv_out) {
+    *srv_out = OpenSession();
+    return 0;
+}
+
+Result nsListApplicationRecord(NsApplicationRecord *, s32, s32, s32 *) {
+    return ResultNoSystem;
+}
+
+Result nsListApplicationContentMetaStatus(u64, s32, NsApplicationContentMetaStatus *, s32, s32 *) {
+    return ResultNoSystem;
+}
+
+Result nsGetApplicationControlData(NsApplicationControlSource, u64, NsApplicationControlData *, size_t, u64 *) {
+    return ResultNoSystem;
+}
+
+Result nsCalculateApplicationOccupiedSize(u64, NsApplicationOccupiedSize *) {
+    return ResultNoSystem;
+}
+
+Result nsGetFreeSpaceSize(NcmStorageId, s64 *) {
+    return ResultNoSystem;
+}
+
+Result nsRequestUpdateApplication2(AsyncResult *, u64) {
+    return ResultNoSystem;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "harness.hpp"
+#include "ipc_trace.hpp"
+#include "paths.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/* Run a cold and a warm scan from the recording, the way they went on the console. */
+bool Replay() {
+    ResetState();
+    IpcTraceReset();
+
+    u64 start = armGetSystemTick();
+    VersionList list;
+    WaitForScan(list);
+    const size_t listed = list.GetUpdatePlan().size();
+    std::printf("  Cold scan: %.3fs, %zu titles listed\n", SecondsSince(start), listed);
+    PrintCommands();
+
+    IpcTraceReset();
+    start = armGetSystemTick();
+    list.Refresh();
+    WaitForScan(list);
+    std::printf("  Warm scan: %.3fs, %zu titles listed\n", SecondsSince(start), list.GetUpdatePlan().size());
+    PrintCommands();
+
+    /* Anything other than every recorded response served once means the scans went differently. */
+    const u32 misses = IpcReplayGetMisses(), repeats = IpcReplayGetRepeats(), unconsumed = IpcReplayGetUnconsumed();
+    const auto records = IpcTraceGetTotals(IpcCommand::ListApplicationRecord);
+    const bool ok = records.calls != 0 && records.failures == 0 && misses == 0 && repeats == 0 && unconsumed == 0;
+    std::printf("Replay %s, %u calls not in the recording, %u served a used up response, %u responses left over\n", ok ? "passed" : "FAILED", misses, repeats, unconsumed);
+    return ok;
+}
+
+void Usage(const char *name) {
+    std::fprintf(stderr, "Usage: %s [--time-scale F] [recording]\n", name);
+}
+
+}
+
+int main(int argc, char **argv) {
+    const char *path = CONFIG_DIRECTORY "ipc.trace";
+    float time_scale = 1.f;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            time_scale = std::atof(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::printf("Replaying %s at %.2fx the recorded latency\n", path, time_scale);
+    IpcReplaySetRecording(path);
+    IpcReplaySetTimeScale(time_scale);
+
+    const bool ok = Replay();
+    IpcTraceExit();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "benchmarks.hpp"
+#include "harness.hpp"
+#include "ipc_trace.hpp"
+#include "version_list.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/* Scan a large library cold and warm, then update every listed title and check the list shrinks accordingly. */
+bool LoadTest(const SimulatorConfig &config) {
+    ResetState();
+    IpcSimulatorConfigure(config);
+    IpcTraceReset();
+    std::printf("Load test: %d titles, %dus per command, %dus per update\n", config.titles, config.latency_us, config.update_latency_us);
+
+    u64 start = armGetSystemTick();
+    VersionList list;
+    WaitForScan(list);
+    const size_t listed = list.GetUpdatePlan().size();
+    std::printf("  Cold scan: %.3fs, %zu titles listed\n", SecondsSince(start), listed);
+    PrintCommands();
+
+    IpcTraceReset();
+    start = armGetSystemTick();
+    list.Refresh();
+    WaitForScan(list);
+    std::printf("  Warm scan: %.3fs, %zu titles listed\n", SecondsSince(start), list.GetUpdatePlan().size());
+    PrintCommands();
+
+    /* The replay runs the same two scans and nothing else, every recorded response has to be used. */
+    IpcRecordStop();
+
+    /* Titles that don't fit into the free space are deferred to the next pass, like pressing Update all again. */
+    IpcTraceReset();
+    start = armGetSystemTick();
+    size_t remaining = listed;
+    u32 passes = 0, finished = 0, failed = 0;
+    u64 last_start_tick = list.GetUpdateProgress().start_tick;
+    while (true) {
+        list.UpdateAllApplications();
+        WaitForUpdates(list);
+        passes++;
+
+        /* The counters only start over once something is queued, a pass that queued nothing still shows the previous one. */
+        const auto progress = list.GetUpdateProgress();
+        if (progress.start_tick != last_start_tick) {
+            finished += progress.finished;
+            failed += progress.failed;
+            last_start_tick = progress.start_tick;
+        }
+
+        const size_t left = list.GetUpdatePlan().size();
+        if (left >= remaining)
+            break;
+        remaining = left;
+    }
+    const double seconds = SecondsSince(start);
+    std::printf("  Updates: %u passes, %u finished, %u failed in %.3fs, %.1f titles/s, %u patches installed, %zu titles still listed\n",
+        passes, finished, failed, seconds, finished / seconds, IpcSimulatorGetInstalledUpdates(), remaining);
+    PrintCommands();
+
+    bool ok = listed != 0 && remaining < listed;
+    if (config.failure_rate == 0.f)
+        ok = ok && failed == 0 && remaining == 0 && IpcSimulatorGetInstalledUpdates() == listed && finished == IpcSimulatorGetInstalledUpdates();
+    std::printf("Load test %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
+
+struct Mode {
+    const char *name;
+    bool (*run)(const SimulatorConfig &config);
+};
+
+constexpr Mode Modes[] = {
+    { "load",    LoadTest },
+    { "lookup",  LookupBenchmark },
+    { "records", RecordsBenchmark },
+    { "scan",    ScanBenchmark },
+    { "updates", UpdatesBenchmark },
+};
+
+void Usage(const char *name) {
+    std::fprintf(stderr, "Usage: %s [load|lookup|records|scan|updates] [--titles N] [--latency-us N] [--update-latency-us N] [--failure-rate F]\n", name);
+}
+
+}
+
+int main(int argc, char **argv) {
+    SimulatorConfig config;
+    /* Fast enough that a full update pass takes a few seconds. */
+    config.update_latency_us = 5000;
+
+    const Mode *mode = &Modes[0];
+    int i = 1;
+    if (i < argc && argv[i][0] != '-') {
+        const auto it = std::find_if(std::begin(Modes), std::end(Modes), [name = argv[i]](const Mode &mode) {
+            return std::strcmp(mode.name, name) == 0;
+        });
+        if (it == std::end(Modes)) {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        mode = it;
+        i++;
+    }
+
+    for (; i < argc; i++) {
+        const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (std::strcmp(arg, "--titles") == 0)
+            config.titles = std::atoi(value);
+        else if (std::strcmp(arg, "--latency-us") == 0)
+            config.latency_us = std::atoi(value);
+        else if (std::strcmp(arg, "--update-latency-us") == 0)
+            config.update_latency_us = std::atoi(value);
+        else if (std::strcmp(arg, "--failure-rate") == 0)
+            config.failure_rate = std::atof(value);
+        else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+
+    const bool ok = mode->run(config);
+    IpcTraceExit();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "async_wait.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+/* The kernel can't be woken by a token, so waits are split into slices to check it. */
+constexpr u64 CancelPollIntervalNs = 100'000'000;
+
+constexpr s32 MaxEvents = 0x40;
+
+}
+
+Result WaitAnyEvent(s32 *index, Event *const *events, s32 count, u64 timeout_ns, const CancelToken *cancel) noexcept {
+    /* Same limit as the kernel, events past it would never be waited on. */
+    if (count < 0 || count > MaxEvents)
+        return KERNELRESULT(OutOfRange);
+
+    std::array<Waiter, MaxEvents> waiters;
+    for (s32 i = 0; i < count; i++)
+        waiters[i] = waiterForEvent(events[i]);
+
+    const u64 deadline = armGetSystemTick() + armNsToTicks(timeout_ns);
+    while (true) {
+        if (cancel != nullptr && *cancel)
+            return ResultCancelled;
+
+        const u64 now = armGetSystemTick();
+        if (now >= deadline)
+            return ResultTimedOut;
+
+        const u64 slice = std::min(armTicksToNs(deadline - now), CancelPollIntervalNs);
+        const Result rc = waitObjects(index, waiters.data(), count, slice);
+        if (rc != ResultTimedOut)
+            return rc;
+    }
+}
+
+Result WaitAsyncResult(AsyncResult *async, u64 timeout_ns, const CancelToken *cancel) noexcept {
+    Event *event = &async->event;
+    s32 index = 0;
+    const Result rc = WaitAnyEvent(&index, &event, 1, timeout_ns, cancel);
+    if (R_FAILED(rc)) {
+        asyncResultCancel(async);
+        return rc;
+    }
+    return asyncResultGet(async);
+}
+
+Result WaitAsyncValue(AsyncValue *async, u64 timeout_ns, const CancelToken *cancel, u64 *size) noexcept {
+    Event *event = &async->event;
+    s32 index = 0;
+    const Result rc = WaitAnyEvent(&index, &event, 1, timeout_ns, cancel);
+    if (R_FAILED(rc)) {
+        asyncValueCancel(async);
+        return rc;
+    }
+    return asyncValueGetSize(async, size);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+#include <atomic>
+
+/* Set from another thread to abandon a wait early. */
+using CancelToken = std::atomic_bool;
+
+/* Reported for requests that were cancelled, either by the caller or after timing out. */
+constexpr Result ResultCancelled = KERNELRESULT(Cancelled);
+constexpr Result ResultTimedOut = KERNELRESULT(TimedOut);
+
+/* Wait until one of the events is signalled, timeout_ns passed or cancel was set.
+ * Returns 0 with the signalled index, ResultTimedOut or ResultCancelled.
+ * More than 0x40 events are rejected with KernelError_OutOfRange.
+ * Without events this is a sleep that can be cancelled. */
+Result WaitAnyEvent(s32 *index, Event *const *events, s32 count, u64 timeout_ns, const CancelToken *cancel) noexcept;
+
+/* Wait for an async request to complete. Requests that time out or are cancelled
+ * are cancelled on the system's side as well, the caller still closes them. */
+Result WaitAsyncResult(AsyncResult *async, u64 timeout_ns, const CancelToken *cancel) noexcept;
+/* Same for requests with a value, size is set to the size of the value on success. */
+Result WaitAsyncValue(AsyncValue *async, u64 timeout_ns, const CancelToken *cancel, u64 *size) noexcept;
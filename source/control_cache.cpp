@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "control_cache.hpp"
+
+#include "ns.h"
+
+#include <algorithm>
+
+namespace {
+
+size_t EntrySize(const ControlData &data) {
+    return sizeof(data) + data.name.size() + data.icon.size();
+}
+
+}
+
+std::shared_ptr<const ControlData> ControlDataCache::Get(ApplicationId application_id, bool with_icon) {
+    {
+        std::scoped_lock lk(this->mutex);
+        if (const auto it = this->lookup.find(application_id); it != std::cend(this->lookup)) {
+            const auto &data = it->second->second;
+            if (!with_icon || !data->icon.empty()) {
+                this->lru.splice(std::begin(this->lru), this->lru, it->second);
+                this->hits++;
+                return data;
+            }
+        }
+    }
+
+    /* Don't hold the lock over IPC, other threads may hit meanwhile. */
+    this->misses++;
+    auto data = this->Fetch(application_id, with_icon);
+    if (data != nullptr)
+        this->Insert(application_id, data);
+    return data;
+}
+
+/* Cached entry without fetching or touching the LRU order. */
+std::shared_ptr<const ControlData> ControlDataCache::Peek(ApplicationId application_id) {
+    std::scoped_lock lk(this->mutex);
+
+    if (const auto it = this->lookup.find(application_id); it != std::cend(this->lookup))
+        return it->second->second;
+    return nullptr;
+}
+
+void ControlDataCache::Insert(ApplicationId application_id, std::shared_ptr<const ControlData> data) {
+    std::scoped_lock lk(this->mutex);
+
+    if (const auto it = this->lookup.find(application_id); it != std::cend(this->lookup))
+        this->EraseLocked(it->second);
+
+    this->used += EntrySize(*data);
+    this->lru.emplace_front(application_id, std::move(data));
+    this->lookup[application_id] = std::begin(this->lru);
+
+    /* Evict least recently used entries, but always keep the one just added. */
+    while (this->used > this->capacity && this->lru.size() > 1)
+        this->EraseLocked(std::prev(std::end(this->lru)));
+}
+
+void ControlDataCache::Invalidate(ApplicationId application_id) {
+    std::scoped_lock lk(this->mutex);
+
+    if (const auto it = this->lookup.find(application_id); it != std::cend(this->lookup))
+        this->EraseLocked(it->second);
+}
+
+std::shared_ptr<const ControlData> ControlDataCache::Fetch(ApplicationId application_id, bool with_icon) {
+    /* Too large for the stack of a worker thread. */
+    auto buffer = std::make_unique<NsApplicationControlData>();
+    u64 size=0;
+    Result rc = -1;
+    bool full_buffer = false;
+
+    /* Only request the NACP, the icon would be another 128KiB we don't need here. */
+    if (!with_icon && this->name_only_supported)
+        rc = nsPoolGetApplicationControlData(NsApplicationControlSource_Storage, application_id, buffer.get(), sizeof(buffer->nacp), &size);
+
+    if (R_FAILED(rc)) {
+        full_buffer = true;
+        rc = nsPoolGetApplicationControlData(NsApplicationControlSource_Storage, application_id, buffer.get(), sizeof(*buffer), &size);
+
+        /* Full buffer works where the short one didn't, don't bother trying again. */
+        if (R_SUCCEEDED(rc) && !with_icon)
+            this->name_only_supported = false;
+    }
+
+    if (R_FAILED(rc))
+        return nullptr;
+
+    auto data = std::make_shared<ControlData>();
+
+    NacpLanguageEntry *entry = &buffer->nacp.lang[0];
+    nacpGetLanguageEntry(&buffer->nacp, &entry);
+    data->name = entry->name;
+
+    /* Name only entries stay small, even when the full buffer had to be fetched. */
+    if (with_icon && full_buffer && size > sizeof(buffer->nacp)) {
+        const auto icon_size = std::min<size_t>(size - sizeof(buffer->nacp), sizeof(buffer->icon));
+        data->icon.assign(buffer->icon, buffer->icon + icon_size);
+    }
+
+    return data;
+}
+
+void ControlDataCache::EraseLocked(std::list<Entry>::iterator it) {
+    this->used -= EntrySize(*it->second);
+    this->lookup.erase(it->first);
+    this->lru.erase(it);
+}
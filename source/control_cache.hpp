@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+#include "application.hpp"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Parsed application control data. The icon is empty until it was requested. */
+struct ControlData {
+    std::string name;
+    std::vector<u8> icon;
+};
+
+/* Bounded LRU cache of control data, safe to use from multiple threads. */
+class ControlDataCache {
+  private:
+    using Entry = std::pair<ApplicationId, std::shared_ptr<const ControlData>>;
+
+    std::list<Entry> lru;
+    std::unordered_map<ApplicationId, std::list<Entry>::iterator> lookup;
+    size_t capacity;
+    size_t used = 0;
+    std::mutex mutex;
+
+    std::atomic<u32> hits = 0, misses = 0;
+    std::atomic_bool name_only_supported = true;
+
+  public:
+    explicit ControlDataCache(size_t capacity) : capacity(capacity) { }
+
+    std::shared_ptr<const ControlData> Get(ApplicationId application_id, bool with_icon);
+    std::shared_ptr<const ControlData> Peek(ApplicationId application_id);
+    void Insert(ApplicationId application_id, std::shared_ptr<const ControlData> data);
+    void Invalidate(ApplicationId application_id);
+
+    u32 GetHits() const noexcept {
+        return this->hits;
+    }
+
+    u32 GetMisses() const noexcept {
+        return this->misses;
+    }
+
+  private:
+    std::shared_ptr<const ControlData> Fetch(ApplicationId application_id, bool with_icon);
+    void EraseLocked(std::list<Entry>::iterator it);
+};
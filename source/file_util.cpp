@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_util.hpp"
+
+#include <sys/stat.h>
+
+void CreateParentDirectories(const char *path) {
+    std::string dir = path;
+    for (size_t pos = dir.find('/', dir.find(":/") + 2); pos != std::string::npos; pos = dir.find('/', pos + 1))
+        mkdir(dir.substr(0, pos).c_str(), 0777);
+}
+
+std::string TemporaryPath(const char *path) {
+    return std::string(path) + ".tmp";
+}
+
+/* Close the temporary file and move it in place if everything was written. */
+bool CommitFile(std::FILE *file, bool ok, const char *path) {
+    const auto tmp_path = TemporaryPath(path);
+
+    ok = std::fclose(file) == 0 && ok;
+
+    if (ok) {
+        std::remove(path);
+        ok = std::rename(tmp_path.c_str(), path) == 0;
+    } else {
+        std::remove(tmp_path.c_str());
+    }
+
+    return ok;
+}
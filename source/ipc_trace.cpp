@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ipc_trace.hpp"
+
+#ifdef IPC_INSTRUMENTED
+
+#include "file_util.hpp"
+#include "paths.hpp"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr const char *StatisticsPath = STATE_DIRECTORY "ipc_trace.txt";
+constexpr const char *RecordingPath  = CONFIG_DIRECTORY "ipc.trace";
+
+/* Bucket i counts calls that took [2^i, 2^(i+1)) microseconds, the last one everything slower. */
+constexpr size_t HistogramBuckets = 20;
+
+enum class ReplayMode {
+    /* Served from the recording. */
+    Replay,
+    /* Opens a session, the commands sent on it are replayed. */
+    PassThrough,
+    /* Hands out an async object that can't be recreated from a recording. */
+    Unavailable,
+};
+
+struct CommandInfo {
+    const char *interface;
+    u32 id;
+    const char *name;
+    ReplayMode replay;
+};
+
+constexpr std::array<CommandInfo, static_cast<size_t>(IpcCommand::Count)> Commands = {{
+    { "IApplicationManagerInterface", 0,    "ListApplicationRecord",            ReplayMode::Replay },
+    { "IApplicationManagerInterface", 11,   "CalculateApplicationOccupiedSize", ReplayMode::Replay },
+    { "IApplicationManagerInterface", 47,   "GetFreeSpaceSize",                 ReplayMode::Replay },
+    { "IApplicationManagerInterface", 85,   "RequestUpdateApplication2",        ReplayMode::Unavailable },
+    { "IApplicationManagerInterface", 400,  "GetApplicationControlData",        ReplayMode::Replay },
+    { "IApplicationManagerInterface", 601,  "ListApplicationContentMetaStatus", ReplayMode::Replay },
+    { "IApplicationVersionInterface", 0,    "GetLaunchRequiredVersion",         ReplayMode::Replay },
+    { "IApplicationVersionInterface", 1,    "UpgradeLaunchRequiredVersion",     ReplayMode::Replay },
+    { "IApplicationVersionInterface", 35,   "UpdateVersionList",                ReplayMode::Replay },
+    { "IApplicationVersionInterface", 36,   "PushLaunchVersion",                ReplayMode::Replay },
+    { "IApplicationVersionInterface", 37,   "ListRequiredVersion",              ReplayMode::Replay },
+    { "IApplicationVersionInterface", 800,  "RequestVersionList",               ReplayMode::Replay },
+    { "IApplicationVersionInterface", 801,  "ListVersionList",                  ReplayMode::Replay },
+    { "IApplicationVersionInterface", 802,  "RequestVersionListData",           ReplayMode::Unavailable },
+    { "IApplicationVersionInterface", 1000, "PerformAutoUpdate",                ReplayMode::Replay },
+    { "IApplicationVersionInterface", 1001, "ListAutoUpdateSchedule",           ReplayMode::Replay },
+    { "IGetterInterface",             7989, "GetApplicationVersionInterface",   ReplayMode::PassThrough },
+    { "IGetterInterface",             7996, "GetApplicationManagerInterface",   ReplayMode::PassThrough },
+}};
+
+struct CommandStats {
+    std::atomic<u32> calls, failures;
+    std::atomic<u64> bytes, total_ns, max_ns;
+    std::array<std::atomic<u32>, HistogramBuckets> histogram;
+};
+
+std::array<CommandStats, static_cast<size_t>(IpcCommand::Count)> g_stats;
+
+size_t Bucket(u64 ns) {
+    const u64 us = ns / 1'000;
+    return us == 0 ? 0 : std::min<size_t>(std::bit_width(us) - 1, HistogramBuckets - 1);
+}
+
+/* Upper bound of the bucket the given fraction of calls falls into, in microseconds. */
+u64 Percentile(const CommandStats &stats, u32 calls, float fraction) {
+    const u32 target = static_cast<u32>(calls * fraction);
+    u32 seen = 0;
+    for (size_t i = 0; i < HistogramBuckets; i++) {
+        seen += stats.histogram[i];
+        if (seen > target)
+            return u64(2) << i;
+    }
+    return u64(2) << (HistogramBuckets - 1);
+}
+
+#if defined(IPC_RECORD) || defined(IPC_REPLAY)
+
+constexpr u32 RecordingMagic   = 0x52415455; /* UTAR */
+constexpr u32 RecordingVersion = 1;
+
+struct RecordingHeader {
+    u32 magic;
+    u32 version;
+};
+
+/* Followed by out_count outputs, each a u32 size and that many bytes. Trailing zeroes are left out. */
+struct RecordingEntry {
+    u32 command;
+    Result rc;
+    u64 latency_ns;
+    u64 key;
+    u32 out_count;
+    u32 reserved;
+};
+
+/* Calls are matched by command and the bytes they were sent, FNV-1a over both. */
+u64 Key(IpcCommand command, const IpcBuffers &in) {
+    u64 hash = 0xcbf29ce484222325;
+    const auto mix = [&hash](const void *data, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ static_cast<const u8 *>(data)[i]) * 0x100000001b3;
+    };
+
+    const u32 id = static_cast<u32>(command);
+    mix(&id, sizeof(id));
+    for (size_t i = 0; i < in.count; i++)
+        mix(in.buffers[i].data, in.buffers[i].size);
+    return hash;
+}
+
+#endif
+
+#ifdef IPC_RECORD
+
+std::mutex g_record_mutex;
+std::FILE *g_record_file = nullptr;
+bool g_record_ok = true;
+u32 g_record_count = 0;
+bool g_record_stopped = false;
+
+#endif
+
+#ifdef IPC_REPLAY
+
+/* Reported for commands the recording has no response for. */
+constexpr Result ResultNotRecorded = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+struct ReplayEntry {
+    Result rc;
+    u64 latency_ns;
+    std::vector<std::vector<u8>> outputs;
+};
+
+/* Responses per call in recorded order. Once used up the last one is served again, so refreshing stays stable. */
+struct ReplayQueue {
+    std::vector<ReplayEntry> entries;
+    size_t next;
+};
+
+std::mutex g_replay_mutex;
+std::string g_replay_path = RecordingPath;
+bool g_replay_loaded = false;
+std::unordered_map<u64, ReplayQueue> g_replay;
+u32 g_replay_misses = 0, g_replay_repeats = 0;
+std::atomic<float> g_replay_time_scale = 1.f;
+
+/* Called with the replay lock held. */
+void LoadRecording() {
+    g_replay_loaded = true;
+
+    auto file = std::fopen(g_replay_path.c_str(), "rb");
+    if (file == nullptr)
+        return;
+
+    RecordingHeader header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != RecordingMagic || header.version != RecordingVersion) {
+        std::fclose(file);
+        return;
+    }
+
+    RecordingEntry entry;
+    while (std::fread(&entry, sizeof(entry), 1, file) == 1) {
+        ReplayEntry replay = { .rc = entry.rc, .latency_ns = entry.latency_ns };
+        replay.outputs.resize(entry.out_count);
+
+        bool ok = true;
+        for (auto &output: replay.outputs) {
+            u32 size = 0;
+            ok = std::fread(&size, sizeof(size), 1, file) == 1;
+            output.resize(size);
+            ok = ok && std::fread(output.data(), 1, size, file) == size;
+            if (!ok)
+                break;
+        }
+        if (!ok)
+            break;
+
+        g_replay[entry.key].entries.push_back(std::move(replay));
+    }
+
+    std::fclose(file);
+}
+
+#endif
+
+}
+
+void IpcTraceRecord(IpcCommand command, size_t bytes, u64 ticks, Result rc) noexcept {
+    auto &stats = g_stats[static_cast<size_t>(command)];
+    const u64 ns = armTicksToNs(ticks);
+
+    stats.calls++;
+    if (R_FAILED(rc))
+        stats.failures++;
+    stats.bytes += bytes;
+    stats.total_ns += ns;
+    for (u64 max = stats.max_ns; ns > max && !stats.max_ns.compare_exchange_weak(max, ns);)
+        ;
+    stats.histogram[Bucket(ns)]++;
+}
+
+#ifdef IPC_RECORD
+
+void IpcRecord(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, u64 ticks, Result rc) noexcept {
+    if (Commands[static_cast<size_t>(command)].replay != ReplayMode::Replay)
+        return;
+
+    const RecordingEntry entry = {
+        .command    = static_cast<u32>(command),
+        .rc         = rc,
+        .latency_ns = armTicksToNs(ticks),
+        .key        = Key(command, in),
+        .out_count  = static_cast<u32>(out.count),
+    };
+
+    std::scoped_lock lk(g_record_mutex);
+    if (g_record_stopped)
+        return;
+
+    if (g_record_file == nullptr) {
+        CreateParentDirectories(RecordingPath);
+        g_record_file = std::fopen(TemporaryPath(RecordingPath).c_str(), "wb");
+        if (g_record_file == nullptr)
+            return;
+
+        const RecordingHeader header = { RecordingMagic, RecordingVersion };
+        g_record_ok = std::fwrite(&header, sizeof(header), 1, g_record_file) == 1;
+    }
+
+    g_record_ok &= std::fwrite(&entry, sizeof(entry), 1, g_record_file) == 1;
+    for (size_t i = 0; i < out.count; i++) {
+        /* List buffers are mostly unused capacity, the zeroes are restored on replay. */
+        const auto *data = static_cast<const u8 *>(out.buffers[i].data);
+        u32 size = R_SUCCEEDED(rc) ? out.buffers[i].size : 0;
+        while (size != 0 && data[size - 1] == 0)
+            size--;
+
+        g_record_ok &= std::fwrite(&size, sizeof(size), 1, g_record_file) == 1;
+        g_record_ok &= std::fwrite(data, 1, size, g_record_file) == size;
+    }
+    g_record_count++;
+}
+
+#endif
+
+#ifdef IPC_REPLAY
+
+bool IpcReplay(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, Result &rc) noexcept {
+    switch (Commands[static_cast<size_t>(command)].replay) {
+        case ReplayMode::PassThrough:
+            return false;
+        case ReplayMode::Unavailable:
+            rc = ResultNotRecorded;
+            return true;
+        case ReplayMode::Replay:
+            break;
+    }
+
+    u64 latency_ns = 0;
+    {
+        std::scoped_lock lk(g_replay_mutex);
+        if (!g_replay_loaded)
+            LoadRecording();
+
+        const auto it = g_replay.find(Key(command, in));
+        if (it == std::end(g_replay)) {
+            g_replay_misses++;
+            rc = ResultNotRecorded;
+            return true;
+        }
+
+        auto &queue = it->second;
+        if (queue.next >= queue.entries.size())
+            g_replay_repeats++;
+        const auto &entry = queue.entries[std::min(queue.next, queue.entries.size() - 1)];
+        queue.next++;
+
+        for (size_t i = 0; i < std::min(out.count, entry.outputs.size()); i++) {
+            const auto &output = entry.outputs[i];
+            const size_t size = std::min(output.size(), out.buffers[i].size);
+            std::memcpy(out.buffers[i].data, output.data(), size);
+            std::memset(static_cast<u8 *>(out.buffers[i].data) + size, 0, out.buffers[i].size - size);
+        }
+        rc = entry.rc;
+        latency_ns = entry.latency_ns;
+    }
+
+    /* Stand in for the time the system took, so scheduling and overlap behave as recorded. */
+    if (const float scale = g_replay_time_scale; scale > 0.f)
+        svcSleepThread(static_cast<s64>(latency_ns * scale));
+    return true;
+}
+
+void IpcReplaySetRecording(const char *path) noexcept {
+    std::scoped_lock lk(g_replay_mutex);
+    g_replay_path = path;
+    g_replay_loaded = false;
+    g_replay.clear();
+}
+
+void IpcReplaySetTimeScale(float scale) noexcept {
+    g_replay_time_scale = scale;
+}
+
+u32 IpcReplayGetMisses() noexcept {
+    std::scoped_lock lk(g_replay_mutex);
+    return g_replay_misses;
+}
+
+u32 IpcReplayGetRepeats() noexcept {
+    std::scoped_lock lk(g_replay_mutex);
+    return g_replay_repeats;
+}
+
+u32 IpcReplayGetUnconsumed() noexcept {
+    std::scoped_lock lk(g_replay_mutex);
+    u32 unconsumed = 0;
+    for (const auto &[key, queue]: g_replay)
+        unconsumed += queue.entries.size() - std::min(queue.next, queue.entries.size());
+    return unconsumed;
+}
+
+#endif
+
+const char *IpcCommandName(IpcCommand command) noexcept {
+    return Commands[static_cast<size_t>(command)].name;
+}
+
+IpcCommandTotals IpcTraceGetTotals(IpcCommand command) noexcept {
+    const auto &stats = g_stats[static_cast<size_t>(command)];
+    return { stats.calls, stats.failures, stats.total_ns };
+}
+
+void IpcTraceReset() noexcept {
+    for (auto &stats: g_stats) {
+        stats.calls = 0;
+        stats.failures = 0;
+        stats.bytes = 0;
+        stats.total_ns = 0;
+        stats.max_ns = 0;
+        for (auto &bucket: stats.histogram)
+            bucket = 0;
+    }
+}
+
+void IpcTraceDrawOverlay() noexcept {
+    ImGui::SetNextWindowPos(ImVec2{760.f, 420.f}, ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2{500.f, 280.f}, ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("IPC Trace", nullptr, ImGuiWindowFlags_NoCollapse))
+        return ImGui::End();
+
+#ifdef IPC_RECORD
+    {
+        std::scoped_lock lk(g_record_mutex);
+        ImGui::Text("Recording: %u responses", g_record_count);
+    }
+#endif
+#ifdef IPC_REPLAY
+    {
+        float scale = g_replay_time_scale;
+        if (ImGui::SliderFloat("Replay time scale", &scale, 0.f, 4.f, "%.2fx"))
+            g_replay_time_scale = scale;
+
+        std::scoped_lock lk(g_replay_mutex);
+        ImGui::Text("Replaying: %zu calls recorded, %u not found, %u repeated", g_replay.size(), g_replay_misses, g_replay_repeats);
+    }
+#endif
+
+    ImGui::Columns(5);
+    ImGui::Text("Command");  ImGui::NextColumn();
+    ImGui::Text("Calls");    ImGui::NextColumn();
+    ImGui::Text("KiB");      ImGui::NextColumn();
+    ImGui::Text("Avg us");   ImGui::NextColumn();
+    ImGui::Text("p99 us");   ImGui::NextColumn();
+    ImGui::Separator();
+
+    for (size_t i = 0; i < g_stats.size(); i++) {
+        const auto &stats = g_stats[i];
+        const u32 calls = stats.calls;
+        if (calls == 0)
+            continue;
+
+        ImGui::Text("%s", Commands[i].name);               ImGui::NextColumn();
+        ImGui::Text("%u (%u failed)", calls, stats.failures.load()); ImGui::NextColumn();
+        ImGui::Text("%lu", stats.bytes / 1024);            ImGui::NextColumn();
+        ImGui::Text("%lu", stats.total_ns / calls / 1'000); ImGui::NextColumn();
+        ImGui::Text("<%lu", Percentile(stats, calls, .99f)); ImGui::NextColumn();
+    }
+
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+#ifdef IPC_RECORD
+
+void IpcRecordStop() noexcept {
+    std::scoped_lock lk(g_record_mutex);
+    if (g_record_file != nullptr)
+        CommitFile(g_record_file, g_record_ok, RecordingPath);
+    g_record_file = nullptr;
+    g_record_stopped = true;
+}
+
+#endif
+
+void IpcTraceExit() noexcept {
+#ifdef IPC_RECORD
+    IpcRecordStop();
+#endif
+
+    CreateParentDirectories(StatisticsPath);
+    auto file = std::fopen(TemporaryPath(StatisticsPath).c_str(), "w");
+    if (file == nullptr)
+        return;
+
+    bool ok = true;
+    for (size_t i = 0; i < g_stats.size(); i++) {
+        const auto &stats = g_stats[i];
+        const u32 calls = stats.calls;
+        if (calls == 0)
+            continue;
+
+        const auto &info = Commands[i];
+        ok &= std::fprintf(file, "%s %u %s: calls %u, failed %u, bytes %lu, avg %luus, max %luus\n",
+            info.interface, info.id, info.name, calls, stats.failures.load(), stats.bytes.load(),
+            stats.total_ns / calls / 1'000, stats.max_ns / 1'000) > 0;
+
+        /* Histogram as "<upper bound in us>:<calls>", empty buckets left out. */
+        ok &= std::fputs("   ", file) >= 0;
+        for (size_t bucket = 0; bucket < HistogramBuckets; bucket++) {
+            if (const u32 count = stats.histogram[bucket]; count != 0)
+                ok &= std::fprintf(file, " <%lu:%u", u64(2) << bucket, count) > 0;
+        }
+        ok &= std::fputc('\n', file) != EOF;
+    }
+
+    CommitFile(file, ok, StatisticsPath);
+}
+
+#endif
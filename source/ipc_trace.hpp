@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+#include <array>
+#include <cstddef>
+
+/* NS commands that are traced, by interface and command id. */
+enum class IpcCommand {
+    /* IApplicationManagerInterface */
+    ListApplicationRecord,
+    CalculateApplicationOccupiedSize,
+    GetFreeSpaceSize,
+    RequestUpdateApplication2,
+    GetApplicationControlData,
+    ListApplicationContentMetaStatus,
+    /* IApplicationVersionInterface */
+    GetLaunchRequiredVersion,
+    UpgradeLaunchRequiredVersion,
+    UpdateVersionList,
+    PushLaunchVersion,
+    ListRequiredVersion,
+    RequestVersionList,
+    ListVersionList,
+    RequestVersionListData,
+    PerformAutoUpdate,
+    ListAutoUpdateSchedule,
+    /* IGetterInterface */
+    GetApplicationVersionInterface,
+    GetApplicationManagerInterface,
+
+    Count,
+};
+
+/* IPC_RECORD writes every response to a trace, IPC_REPLAY serves them from it instead of asking the system.
+ * IPC_SIMULATE answers from a generated library instead, only in the host build under host/.
+ * All of them come with the statistics of IPC_TRACE. */
+#if defined(IPC_TRACE) || defined(IPC_RECORD) || defined(IPC_REPLAY) || defined(IPC_SIMULATE)
+#define IPC_INSTRUMENTED
+#endif
+
+#if defined(IPC_REPLAY) && defined(IPC_SIMULATE)
+#error "IPC_REPLAY and IPC_SIMULATE both answer in place of the system, pick one"
+#endif
+
+#if defined(IPC_SIMULATE) && defined(__SWITCH__)
+#error "IPC_SIMULATE is only available in the host build, see host/Makefile"
+#endif
+
+#ifdef IPC_INSTRUMENTED
+
+/* Memory a command reads or writes. Inputs identify a call on replay, outputs are what gets recorded. */
+struct IpcBuffer {
+    void *data;
+    size_t size;
+};
+
+template<typename T>
+inline IpcBuffer IpcData(const T &value) {
+    return { const_cast<T *>(&value), sizeof(T) };
+}
+
+template<typename T>
+inline IpcBuffer IpcData(const T *data, size_t count) {
+    return { const_cast<T *>(data), count * sizeof(T) };
+}
+
+struct IpcBuffers {
+    std::array<IpcBuffer, 4> buffers;
+    size_t count;
+
+    size_t Size() const noexcept {
+        size_t size = 0;
+        for (size_t i = 0; i < this->count; i++)
+            size += this->buffers[i].size;
+        return size;
+    }
+};
+
+template<typename... Buffers>
+inline IpcBuffers IpcIn(Buffers... buffers) {
+    static_assert(sizeof...(Buffers) <= 4);
+    return { { buffers... }, sizeof...(Buffers) };
+}
+
+template<typename... Buffers>
+inline IpcBuffers IpcOut(Buffers... buffers) {
+    return IpcIn(buffers...);
+}
+
+/* Count a finished command with the bytes it moved and how long it took. Safe to call from any thread. */
+void IpcTraceRecord(IpcCommand command, size_t bytes, u64 ticks, Result rc) noexcept;
+/* Append a response to the recording. */
+void IpcRecord(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, u64 ticks, Result rc) noexcept;
+/* Fill the outputs from the recording and wait as long as the call took. False if the command must go to the system. */
+bool IpcReplay(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, Result &rc) noexcept;
+/* Answer from the generated library after the configured latency. False if the command must go to the system. */
+bool IpcSimulate(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, Result &rc) noexcept;
+
+template<typename Call>
+inline Result IpcTraced(IpcCommand command, const IpcBuffers &in, const IpcBuffers &out, Call &&call) {
+    const u64 start = armGetSystemTick();
+    Result rc = 0;
+#if defined(IPC_REPLAY)
+    if (!IpcReplay(command, in, out, rc))
+        rc = call();
+#elif defined(IPC_SIMULATE)
+    if (!IpcSimulate(command, in, out, rc))
+        rc = call();
+#else
+    rc = call();
+#endif
+    const u64 ticks = armGetSystemTick() - start;
+    IpcTraceRecord(command, in.Size() + out.Size(), ticks, rc);
+#ifdef IPC_RECORD
+    IpcRecord(command, in, out, ticks, rc);
+#endif
+    return rc;
+}
+
+/* Wraps an expression returning the command's Result, in and out list the memory it reads and writes. */
+#define IPC_TRACED(command, in, out, call) IpcTraced((command), (in), (out), [&]() -> Result { return (call); })
+
+/* Totals of one command since startup or the last reset. */
+struct IpcCommandTotals {
+    u32 calls;
+    u32 failures;
+    u64 total_ns;
+};
+
+const char *IpcCommandName(IpcCommand command) noexcept;
+IpcCommandTotals IpcTraceGetTotals(IpcCommand command) noexcept;
+/* Start counting from zero, for measuring one run at a time. */
+void IpcTraceReset() noexcept;
+
+#ifdef IPC_REPLAY
+/* Serve a recording from somewhere else than the config directory. Before the first command. */
+void IpcReplaySetRecording(const char *path) noexcept;
+/* Recorded latencies are multiplied by this, 0 answers right away. */
+void IpcReplaySetTimeScale(float scale) noexcept;
+/* Calls that had no response in the recording. */
+u32 IpcReplayGetMisses() noexcept;
+/* Calls whose recorded responses were used up, served the last one again. */
+u32 IpcReplayGetRepeats() noexcept;
+/* Recorded responses that were never served. */
+u32 IpcReplayGetUnconsumed() noexcept;
+#endif
+
+#ifdef IPC_RECORD
+/* Finish the recording early, later commands aren't recorded. */
+void IpcRecordStop() noexcept;
+#endif
+
+/* Table of every command seen so far, with replay controls. */
+void IpcTraceDrawOverlay() noexcept;
+/* Write the statistics and finish the recording. */
+void IpcTraceExit() noexcept;
+
+#else
+
+/* Compiled out entirely, the call is left as it was and in and out are never evaluated. */
+#define IPC_TRACED(command, in, out, call) (call)
+
+inline void IpcTraceDrawOverlay() noexcept {}
+inline void IpcTraceExit() noexcept {}
+
+#endif
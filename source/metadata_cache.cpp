@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metadata_cache.hpp"
+
+#include "file_util.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr u32 CacheMagic   = 0x43415455; /* UTAC */
+constexpr u32 CacheVersion = 1;
+
+struct CacheHeader {
+    u32 magic;
+    u32 version;
+    u32 count;
+    u32 reserved;
+};
+
+struct CacheEntryHeader {
+    NsApplicationRecord record;
+    u32 application_version;
+    u32 patch_version;
+    u32 add_on_count;
+    u32 name_size;
+    u32 icon_size;
+    u32 reserved;
+};
+
+struct CacheAddOn {
+    u64 id;
+    u32 version;
+    u32 reserved;
+};
+
+/* Icons are at most 128KiB, names at most 0x200 bytes. Anything larger is corrupt. */
+constexpr u32 MaxNameSize  = sizeof(NacpLanguageEntry::name);
+constexpr u32 MaxIconSize  = sizeof(NsApplicationControlData::icon);
+constexpr u32 MaxAddOns    = 0x2000;
+
+}
+
+bool MetadataCache::Load() {
+    this->entries.clear();
+
+    auto file = std::fopen(this->path, "rb");
+    if (file == nullptr)
+        return false;
+
+    CacheHeader header = {};
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == CacheMagic && header.version == CacheVersion;
+
+    for (u32 i = 0; ok && i < header.count; i++) {
+        CacheEntryHeader entry_header = {};
+        ok = std::fread(&entry_header, sizeof(entry_header), 1, file) == 1
+            && entry_header.add_on_count <= MaxAddOns && entry_header.name_size <= MaxNameSize && entry_header.icon_size <= MaxIconSize;
+        if (!ok)
+            break;
+
+        Entry entry = { .record = entry_header.record };
+        entry.versions.application = entry_header.application_version;
+        entry.versions.patch = entry_header.patch_version;
+
+        for (u32 j = 0; ok && j < entry_header.add_on_count; j++) {
+            CacheAddOn add_on = {};
+            ok = std::fread(&add_on, sizeof(add_on), 1, file) == 1;
+            entry.versions.add_ons.emplace_back(add_on.id, add_on.version);
+        }
+
+        if (ok && entry_header.name_size != 0) {
+            auto control = std::make_shared<ControlData>();
+            control->name.resize(entry_header.name_size);
+            control->icon.resize(entry_header.icon_size);
+            ok = std::fread(control->name.data(), 1, control->name.size(), file) == control->name.size()
+                && std::fread(control->icon.data(), 1, control->icon.size(), file) == control->icon.size();
+            entry.control = std::move(control);
+        }
+
+        if (ok)
+            this->entries[entry.record.application_id] = std::move(entry);
+    }
+
+    std::fclose(file);
+
+    /* Partially read caches are not trusted. */
+    if (!ok)
+        this->entries.clear();
+
+    return ok;
+}
+
+bool MetadataCache::Save() const {
+    CreateParentDirectories(this->path);
+
+    auto file = std::fopen(TemporaryPath(this->path).c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    const CacheHeader header = {
+        .magic   = CacheMagic,
+        .version = CacheVersion,
+        .count   = static_cast<u32>(this->entries.size()),
+    };
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (const auto &[application_id, entry]: this->entries) {
+        const auto &control = entry.control;
+        const CacheEntryHeader entry_header = {
+            .record              = entry.record,
+            .application_version = entry.versions.application,
+            .patch_version       = entry.versions.patch,
+            .add_on_count        = static_cast<u32>(entry.versions.add_ons.size()),
+            .name_size           = control != nullptr ? static_cast<u32>(control->name.size()) : 0,
+            .icon_size           = control != nullptr ? static_cast<u32>(control->icon.size()) : 0,
+        };
+        ok = ok && std::fwrite(&entry_header, sizeof(entry_header), 1, file) == 1;
+
+        for (const auto &[id, version]: entry.versions.add_ons) {
+            const CacheAddOn add_on = { .id = id, .version = version };
+            ok = ok && std::fwrite(&add_on, sizeof(add_on), 1, file) == 1;
+        }
+
+        if (entry_header.name_size != 0) {
+            ok = ok && std::fwrite(control->name.data(), 1, control->name.size(), file) == control->name.size()
+                && std::fwrite(control->icon.data(), 1, control->icon.size(), file) == control->icon.size();
+        }
+
+        if (!ok)
+            break;
+    }
+
+    ok = CommitFile(file, ok, this->path);
+    this->dirty = !ok;
+    return ok;
+}
+
+/* Cached metadata, only if the application record didn't change since it was stored. */
+const MetadataCache::Entry *MetadataCache::Lookup(const NsApplicationRecord &record) const noexcept {
+    const auto it = this->entries.find(record.application_id);
+    if (it == std::cend(this->entries))
+        return nullptr;
+
+    if (std::memcmp(&it->second.record, &record, sizeof(record)) != 0)
+        return nullptr;
+
+    return &it->second;
+}
+
+/* Only a changed entry makes the cache dirty, unchanged titles are stored again on every scan. */
+void MetadataCache::Store(const NsApplicationRecord &record, const InstalledVersions &versions, std::shared_ptr<const ControlData> control) {
+    const auto it = this->entries.find(record.application_id);
+    if (it != std::end(this->entries)) {
+        const auto &entry = it->second;
+        if (std::memcmp(&entry.record, &record, sizeof(record)) == 0 && entry.control == control
+            && entry.versions.application == versions.application && entry.versions.patch == versions.patch && entry.versions.add_ons == versions.add_ons)
+            return;
+    }
+
+    this->entries[record.application_id] = { record, versions, std::move(control) };
+    this->dirty = true;
+}
+
+/* Pick up names and icons fetched after the entries were stored. */
+void MetadataCache::RefreshControls(ControlDataCache &cache) {
+    for (auto &[application_id, entry]: this->entries) {
+        auto control = cache.Peek(application_id);
+        if (control != nullptr && control != entry.control) {
+            entry.control = std::move(control);
+            this->dirty = true;
+        }
+    }
+}
+
+/* Drop applications that are no longer installed. */
+void MetadataCache::Retain(const std::vector<ApplicationId> &application_ids) {
+    const std::unordered_set<ApplicationId> keep(std::cbegin(application_ids), std::cend(application_ids));
+    if (std::erase_if(this->entries, [&](const auto &pair) { return !keep.contains(pair.first); }) != 0)
+        this->dirty = true;
+}
+
+void MetadataCache::Clear() noexcept {
+    this->entries.clear();
+    this->dirty = true;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+#include "application.hpp"
+#include "control_cache.hpp"
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/* Per application metadata persisted on the SD card between launches. */
+class MetadataCache {
+  public:
+    struct Entry {
+        NsApplicationRecord record;
+        InstalledVersions versions;
+        std::shared_ptr<const ControlData> control;
+    };
+
+  private:
+    std::unordered_map<ApplicationId, Entry> entries;
+    const char *path;
+    mutable bool dirty = false;
+
+  public:
+    explicit MetadataCache(const char *path) : path(path) { }
+
+    bool Load();
+    bool Save() const;
+
+    bool IsDirty() const noexcept {
+        return this->dirty;
+    }
+
+    const Entry *Lookup(const NsApplicationRecord &record) const noexcept;
+    void Store(const NsApplicationRecord &record, const InstalledVersions &versions, std::shared_ptr<const ControlData> control);
+    void RefreshControls(ControlDataCache &cache);
+    void Retain(const std::vector<ApplicationId> &application_ids);
+    void Clear() noexcept;
+};
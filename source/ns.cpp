@@ -1,119 +1,219 @@
 #include "ns.h"
+#include "ns_session.hpp"
+
+#include "ipc_trace.hpp"
 
 #include <cstring>
 
-static Result _nsVersionNoInNoOut(u32 cmd_id) {
-    Result rc=0;
-    Service srv={};
-    rc = nsGetApplicationVersionInterface(&srv);
+Result nsPoolListApplicationContentMetaStatus(u64 application_id, s32 index, NsApplicationContentMetaStatus* list, s32 count, s32* out_entrycount) {
+    /* Padding spelled out and zeroed, recordings key requests on these bytes. */
+    const struct {
+        s32 index;
+        u32 pad;
+        u64 application_id;
+    } in = { index, 0, application_id };
+
+    NsManagerSession session;
+    Result rc = session.GetResult();
+
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::ListApplicationContentMetaStatus, IpcIn(IpcData(in), IpcData(count)), IpcOut(IpcData(list, count), IpcData(*out_entrycount)), serviceDispatchInOut(session.Get(), 601, in, *out_entrycount,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+        .buffers = { { list, count * sizeof(*list) } },
+    )));
+
+    return rc;
+}
+
+Result nsPoolCalculateApplicationOccupiedSize(u64 application_id, NsApplicationOccupiedSize *out) {
+    NsManagerSession session;
+    Result rc = session.GetResult();
+
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::CalculateApplicationOccupiedSize, IpcIn(IpcData(application_id)), IpcOut(IpcData(*out)), serviceDispatchInOut(session.Get(), 11, application_id, *out)));
 
-    if (R_SUCCEEDED(rc)) rc = serviceDispatch(&srv, cmd_id);
-    
-    serviceClose(&srv);
     return rc;
 }
 
-static Result _nsVersionNoInBufOut(void* buffer, size_t size, u32 *out, u32 cmd_id) {
-    Result rc=0;
-    Service srv={};
-    rc = nsGetApplicationVersionInterface(&srv);
+static Result _nsCmdGetApplicationControlData(Service *srv, NsApplicationControlSource source, u64 application_id, NsApplicationControlData* buffer, size_t size, u64* actual_size) {
+    const struct {
+        u8 source;
+        u8 pad[7];
+        u64 application_id;
+    } in = { source, {0}, application_id };
 
-    if (R_SUCCEEDED(rc)) rc = serviceDispatchOut(&srv, cmd_id, *out,
+    u32 tmp=0;
+    Result rc = serviceDispatchInOut(srv, 400, in, tmp,
         .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
         .buffers = { { buffer, size } },
     );
+    if (R_SUCCEEDED(rc) && actual_size) *actual_size = tmp;
+
+    return rc;
+}
+
+Result nsPoolGetApplicationControlData(NsApplicationControlSource source, u64 application_id, NsApplicationControlData* buffer, size_t size, u64* actual_size) {
+    NsManagerSession session;
+    Result rc = session.GetResult();
+
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::GetApplicationControlData, IpcIn(IpcData(application_id), IpcData(size)), IpcOut(IpcBuffer{ buffer, size }, IpcData(*actual_size)), _nsCmdGetApplicationControlData(session.Get(), source, application_id, buffer, size, actual_size)));
+
+    return rc;
+}
+
+Result nsPoolListApplicationRecord(NsApplicationRecord* records, s32 count, s32 entry_offset, s32* out_entrycount) {
+    NsManagerSession session;
+    Result rc = session.GetResult();
+
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::ListApplicationRecord, IpcIn(IpcData(entry_offset), IpcData(count)), IpcOut(IpcData(records, count), IpcData(*out_entrycount)), serviceDispatchInOut(session.Get(), 0, entry_offset, *out_entrycount,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+        .buffers = { { records, count * sizeof(*records) } },
+    )));
 
-    serviceClose(&srv);
     return rc;
 }
 
-static Result _nsPushVersion(u64 application_id, u32 version, u32 cmd_id) {
-    Result rc=0;
-    Service srv={};
-    rc = nsGetApplicationVersionInterface(&srv);
+Result nsPoolGetFreeSpaceSize(NcmStorageId storage_id, s64 *size) {
+    NsManagerSession session;
+    Result rc = session.GetResult();
 
+    const u64 in = storage_id;
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::GetFreeSpaceSize, IpcIn(IpcData(storage_id)), IpcOut(IpcData(*size)), serviceDispatchInOut(session.Get(), 47, in, *size)));
+
+    return rc;
+}
+
+Result nsPoolRequestUpdateApplication2(AsyncResult *a, u64 application_id) {
+    NsManagerSession session;
+    Result rc = session.GetResult();
+
+    memset(a, 0, sizeof(*a));
+    Handle event = INVALID_HANDLE;
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::RequestUpdateApplication2, IpcIn(IpcData(application_id)), IpcOut(IpcData(*a)), serviceDispatchIn(session.Get(), 85, application_id,
+        .out_num_objects = 1,
+        .out_objects = &a->s,
+        .out_handle_attrs = { SfOutHandleAttr_HipcCopy },
+        .out_handles = &event,
+    )));
+
+    if (R_SUCCEEDED(rc) && event != INVALID_HANDLE)
+        eventLoadRemote(&a->event, event, false);
+
+    return rc;
+}
+
+static Result _nsVersionNoInNoOut(u32 cmd_id, IpcCommand command) {
+    NsVersionSession session;
+    Result rc = session.GetResult();
+
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(command, IpcIn(), IpcOut(), serviceDispatch(session.Get(), cmd_id)));
+
+    return rc;
+}
+
+static Result _nsVersionNoInBufOut(void* buffer, size_t size, u32 *out, u32 cmd_id, IpcCommand command) {
+    NsVersionSession session;
+    Result rc = session.GetResult();
+
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(command, IpcIn(IpcData(size)), IpcOut(IpcBuffer{ buffer, size }, IpcData(*out)), serviceDispatchOut(session.Get(), cmd_id, *out,
+        .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+        .buffers = { { buffer, size } },
+    )));
+
+    return rc;
+}
+
+static Result _nsSessionPushVersion(NsVersionSession &session, u64 application_id, u32 version, u32 cmd_id, IpcCommand command) {
     const struct {
         u32 version;
+        u32 pad;
         u64 application_id;
-    } in = { version, application_id };
+    } in = { version, 0, application_id };
+
+    return session.Check(IPC_TRACED(command, IpcIn(IpcData(in)), IpcOut(), serviceDispatchIn(session.Get(), cmd_id, in)));
+}
+
+static Result _nsPushVersion(u64 application_id, u32 version, u32 cmd_id, IpcCommand command) {
+    NsVersionSession session;
+    Result rc = session.GetResult();
 
-    if (R_SUCCEEDED(rc)) rc = serviceDispatchIn(&srv, cmd_id, in);
+    if (R_SUCCEEDED(rc)) rc = _nsSessionPushVersion(session, application_id, version, cmd_id, command);
 
-    serviceClose(&srv);
     return rc;
 }
 
 Result nsGetLaunchRequiredVersion(u64 application_id, u32 *version) {
-    Result rc=0;
-    Service srv={};
-    rc = nsGetApplicationVersionInterface(&srv);
+    NsVersionSession session;
+    Result rc = session.GetResult();
 
-    if (R_SUCCEEDED(rc)) rc = serviceDispatchInOut(&srv, 0, application_id, *version);
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::GetLaunchRequiredVersion, IpcIn(IpcData(application_id)), IpcOut(IpcData(*version)), serviceDispatchInOut(session.Get(), 0, application_id, *version)));
 
-    serviceClose(&srv);
     return rc;
 }
 
 Result nsUpgradeLaunchRequiredVersion(u64 application_id, u32 version) {
-    return _nsPushVersion(application_id, version, 1);
+    return _nsPushVersion(application_id, version, 1, IpcCommand::UpgradeLaunchRequiredVersion);
 }
 
 Result nsUpdateVersionList(AvmVersionListEntry *buffer, size_t count) {
-    Result rc=0;
-    Service srv={};
-    rc = nsGetApplicationVersionInterface(&srv);
+    NsVersionSession session;
+    Result rc = session.GetResult();
 
-    if (R_SUCCEEDED(rc)) rc = serviceDispatch(&srv, 35,
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::UpdateVersionList, IpcIn(IpcData(buffer, count)), IpcOut(), serviceDispatch(session.Get(), 35,
         .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
         .buffers = { { buffer, count * sizeof(*buffer) } },
-    );
+    )));
 
-    serviceClose(&srv);
     return rc;
 }
 
 Result nsPushLaunchVersion(u64 application_id, u32 version) {
-    return _nsPushVersion(application_id, version, 36);
+    return _nsPushVersion(application_id, version, 36, IpcCommand::PushLaunchVersion);
+}
+
+Result nsPushLaunchVersionBatch(const u64 *application_ids, size_t count, u32 version, Result *results) {
+    NsVersionSession session;
+    Result rc = session.GetResult();
+
+    for (size_t i = 0; i < count; i++)
+        results[i] = R_SUCCEEDED(rc) ? _nsSessionPushVersion(session, application_ids[i], version, 36, IpcCommand::PushLaunchVersion) : rc;
+
+    return rc;
 }
 
 Result nsListRequiredVersion(AvmRequiredVersionEntry *buffer, size_t count, u32 *out) {
-    return _nsVersionNoInBufOut(buffer, count * sizeof(*buffer), out, 37);
+    return _nsVersionNoInBufOut(buffer, count * sizeof(*buffer), out, 37, IpcCommand::ListRequiredVersion);
 }
 
 Result nsRequestVersionList() {
-    return _nsVersionNoInNoOut(800);
+    return _nsVersionNoInNoOut(800, IpcCommand::RequestVersionList);
 }
 
 Result nsListVersionList(AvmVersionListEntry *buffer, size_t count, u32 *out) {
-    return _nsVersionNoInBufOut(buffer, count * sizeof(*buffer), out, 801);
+    return _nsVersionNoInBufOut(buffer, count * sizeof(*buffer), out, 801, IpcCommand::ListVersionList);
 }
 
 Result nsRequestVersionListData(AsyncValue *a) {
-    Result rc=0;
-    Service srv={};
-    
-    rc = nsGetApplicationVersionInterface(&srv);
+    NsVersionSession session;
+    Result rc = session.GetResult();
 
     memset(a, 0, sizeof(*a));
     Handle event = INVALID_HANDLE;
-    if (R_SUCCEEDED(rc)) rc = serviceDispatch(&srv, 802,
+    if (R_SUCCEEDED(rc)) rc = session.Check(IPC_TRACED(IpcCommand::RequestVersionListData, IpcIn(), IpcOut(), serviceDispatch(session.Get(), 802,
         .out_num_objects = 1,
         .out_objects = &a->s,
         .out_handle_attrs = { SfOutHandleAttr_HipcCopy },
         .out_handles = &event,
-    );
+    )));
 
     if (R_SUCCEEDED(rc))
         eventLoadRemote(&a->event, event, false);
 
-    serviceClose(&srv);
     return rc;
 }
 
 Result nsPerformAutoUpdate(void) {
-    return _nsVersionNoInNoOut(1000);
+    return _nsVersionNoInNoOut(1000, IpcCommand::PerformAutoUpdate);
 }
 
 Result nsListAutoUpdateSchedule(void* unk, size_t size, u32 *out) {
-    return _nsVersionNoInBufOut(unk, size, out, 1001);
+    return _nsVersionNoInBufOut(unk, size, out, 1001, IpcCommand::ListAutoUpdateSchedule);
 }
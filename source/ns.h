@@ -18,11 +18,22 @@ typedef enum {
     NsApplicationRecordType_AlreadyStarted  = 0x10,
 } NsApplicationRecordType;
 
+/// IApplicationManagerInterface
+/// Same as the libnx commands, on a pooled session instead of the one shared by every thread.
+Result nsPoolListApplicationContentMetaStatus(u64 application_id, s32 index, NsApplicationContentMetaStatus* list, s32 count, s32* out_entrycount);
+Result nsPoolCalculateApplicationOccupiedSize(u64 application_id, NsApplicationOccupiedSize *out);
+Result nsPoolGetApplicationControlData(NsApplicationControlSource source, u64 application_id, NsApplicationControlData* buffer, size_t size, u64* actual_size);
+Result nsPoolListApplicationRecord(NsApplicationRecord* records, s32 count, s32 entry_offset, s32* out_entrycount);
+Result nsPoolGetFreeSpaceSize(NcmStorageId storage_id, s64 *size);
+Result nsPoolRequestUpdateApplication2(AsyncResult *a, u64 application_id);
+
 /// IApplicationVersionInterface
 Result nsGetLaunchRequiredVersion(u64 application_id, u32 *version);
 Result nsUpgradeLaunchRequiredVersion(u64 application_id, u32 version);
 Result nsUpdateVersionList(AvmVersionListEntry *buffer, size_t count);
 Result nsPushLaunchVersion(u64 application_id, u32 version);
+/// Push the same launch version for every application while holding the session. Individual results are written to results.
+Result nsPushLaunchVersionBatch(const u64 *application_ids, size_t count, u32 version, Result *results);
 Result nsListRequiredVersion(AvmRequiredVersionEntry *buffer, size_t count, u32 *out);
 Result nsRequestVersionList(void);
 Result nsListVersionList(AvmVersionListEntry *buffer, size_t count, u32 *out);
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ns_session.hpp"
+
+#include "ipc_trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+
+struct NsSessionPool {
+    static constexpr size_t Size = 4;
+
+    Result (*open)(Service *srv);
+    /* Session to use instead when no new ones can be opened, nullptr otherwise. */
+    Service *(*fallback)();
+    std::mutex mutex;
+    std::condition_variable condvar;
+    std::array<Service, Size> sessions = {};
+    std::array<std::thread::id, Size> holders = {};
+    std::atomic<u32> checkouts = 0, contended = 0, opened = 0;
+    std::atomic<u64> wait_ns = 0;
+
+    explicit NsSessionPool(Result (*open)(Service *srv), Service *(*fallback)() = nullptr) : open(open), fallback(fallback) {}
+
+    Result Open(Service *srv) {
+        Result rc = this->open(srv);
+        if (R_SUCCEEDED(rc))
+            this->opened++;
+        return rc;
+    }
+
+    NsSessionPoolStats GetStats() const {
+        return { this->checkouts, this->contended, this->wait_ns, this->opened };
+    }
+};
+
+static Result _nsOpenManager(Service *srv) {
+    Service *getter = nsGetServiceSession_GetterInterface();
+    if (!serviceIsActive(getter))
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    return IPC_TRACED(IpcCommand::GetApplicationManagerInterface, IpcIn(), IpcOut(), serviceDispatch(getter, 7996,
+        .out_num_objects = 1,
+        .out_objects = srv,
+    ));
+}
+
+/* Before 3.0.0 there is no getter to open more sessions from, the one libnx opened is shared instead. */
+static Service *_nsManagerFallback() {
+    if (serviceIsActive(nsGetServiceSession_GetterInterface()))
+        return nullptr;
+    return nsGetServiceSession_ApplicationManagerInterface();
+}
+
+static Result _nsOpenVersion(Service *srv) {
+    return IPC_TRACED(IpcCommand::GetApplicationVersionInterface, IpcIn(), IpcOut(), nsGetApplicationVersionInterface(srv));
+}
+
+/* Opened from userAppInit and closed from userAppExit, outside the lifetime of static objects. Never destroyed. */
+static NsSessionPool &_nsManagerPool() {
+    static NsSessionPool *pool = new NsSessionPool(_nsOpenManager, _nsManagerFallback);
+    return *pool;
+}
+
+static NsSessionPool &_nsVersionPool() {
+    static NsSessionPool *pool = new NsSessionPool(_nsOpenVersion);
+    return *pool;
+}
+
+NsPooledSession::NsPooledSession(NsSessionPool *pool) : pool(pool), srv(nullptr), owner(false), shared(false), rc(0) {
+    if (pool->fallback != nullptr && (this->srv = pool->fallback()) != nullptr) {
+        pool->checkouts++;
+        this->shared = true;
+        return;
+    }
+
+    const auto self = std::this_thread::get_id();
+    std::unique_lock lk(pool->mutex);
+
+    for (size_t i = 0; i < NsSessionPool::Size; i++) {
+        if (pool->holders[i] == self)
+            this->srv = &pool->sessions[i];
+    }
+
+    if (this->srv == nullptr) {
+        this->Acquire(lk, self);
+        this->owner = true;
+    }
+    lk.unlock();
+
+    /* The slot is ours, a broken or not yet opened session is replaced outside the lock. */
+    if (!serviceIsActive(this->srv))
+        this->rc = pool->Open(this->srv);
+}
+
+/* Called with the pool lock held. */
+void NsPooledSession::Acquire(std::unique_lock<std::mutex> &lk, std::thread::id self) {
+    auto *pool = this->pool;
+    pool->checkouts++;
+    const auto find_free = [&] {
+        return std::find(std::cbegin(pool->holders), std::cend(pool->holders), std::thread::id()) - std::cbegin(pool->holders);
+    };
+    size_t index = find_free();
+    if (index == NsSessionPool::Size) {
+        pool->contended++;
+        const u64 start = armGetSystemTick();
+        pool->condvar.wait(lk, [&] { return (index = find_free()) != NsSessionPool::Size; });
+        pool->wait_ns += armTicksToNs(armGetSystemTick() - start);
+    }
+    pool->holders[index] = self;
+    this->srv = &pool->sessions[index];
+}
+
+NsPooledSession::~NsPooledSession() {
+    if (!this->owner)
+        return;
+
+    {
+        std::scoped_lock lk(this->pool->mutex);
+        this->pool->holders[this->srv - this->pool->sessions.data()] = {};
+    }
+    this->pool->condvar.notify_one();
+}
+
+Result NsPooledSession::Check(Result rc) {
+    /* Kernel errors come from the transport, not the command. The session doesn't recover from those. */
+    if (R_FAILED(rc) && R_MODULE(rc) == Module_Kernel && !this->shared && serviceIsActive(this->srv))
+        serviceClose(this->srv);
+    return rc;
+}
+
+static void _nsPoolInitialize(NsSessionPool &pool) {
+    if (pool.fallback != nullptr && pool.fallback() != nullptr)
+        return;
+
+    /* Runs before any worker starts, so no slot is checked out. */
+    std::scoped_lock lk(pool.mutex);
+    for (auto &srv: pool.sessions) {
+        if (!serviceIsActive(&srv))
+            pool.Open(&srv);
+    }
+}
+
+static void _nsPoolExit(NsSessionPool &pool) {
+    std::scoped_lock lk(pool.mutex);
+    for (auto &srv: pool.sessions) {
+        if (serviceIsActive(&srv))
+            serviceClose(&srv);
+    }
+}
+
+void nsSessionPoolInitialize() {
+    _nsPoolInitialize(_nsManagerPool());
+    _nsPoolInitialize(_nsVersionPool());
+}
+
+void nsSessionPoolExit() {
+    _nsPoolExit(_nsVersionPool());
+    _nsPoolExit(_nsManagerPool());
+}
+
+NsManagerSession::NsManagerSession() : NsPooledSession(&_nsManagerPool()) {}
+
+NsSessionPoolStats nsGetManagerSessionStats() {
+    return _nsManagerPool().GetStats();
+}
+
+NsVersionSession::NsVersionSession() : NsPooledSession(&_nsVersionPool()) {}
+
+NsSessionPoolStats nsGetVersionSessionStats() {
+    return _nsVersionPool().GetStats();
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <switch.h>
+
+#include <mutex>
+#include <thread>
+
+/* Sessions lent out to one thread at a time. Workers each get their own, so they don't queue up behind one
+ * another on a single session. Sessions are opened up front and reopened lazily when a command breaks one. */
+struct NsSessionPool;
+
+/* Counters for one pool. */
+struct NsSessionPoolStats {
+    /* Sessions handed out. */
+    u32 checkouts;
+    /* Checkouts that had to wait for another thread to return a session. */
+    u32 contended;
+    /* Total time spent waiting. */
+    u64 wait_ns;
+    /* Sessions opened, including replacements for broken ones. */
+    u32 opened;
+};
+
+/* Scoped checkout of a pooled session. A thread that already holds one from the same pool gets it again,
+ * so holding a handle runs several commands back to back on one session. */
+class NsPooledSession {
+  private:
+    NsSessionPool *pool;
+    Service *srv;
+    bool owner;
+    /* Borrowed from libnx, never closed here. */
+    bool shared;
+    Result rc;
+
+    void Acquire(std::unique_lock<std::mutex> &lk, std::thread::id self);
+
+  protected:
+    explicit NsPooledSession(NsSessionPool *pool);
+
+  public:
+    NsPooledSession(const NsPooledSession &) = delete;
+    NsPooledSession &operator=(const NsPooledSession &) = delete;
+    ~NsPooledSession();
+
+    Result GetResult() const {
+        return this->rc;
+    }
+
+    Service *Get() const {
+        return this->srv;
+    }
+
+    /* Pass a command's result through, dropping the session if it is no longer usable. */
+    Result Check(Result rc);
+};
+
+/* Open every pooled session. Called after nsInitialize. */
+void nsSessionPoolInitialize();
+/* Close every pooled session. Called before nsExit. */
+void nsSessionPoolExit();
+
+/* IApplicationManagerInterface. Before 3.0.0 every checkout gets the session libnx shares. */
+class NsManagerSession : public NsPooledSession {
+  public:
+    NsManagerSession();
+};
+
+NsSessionPoolStats nsGetManagerSessionStats();
+
+/* IApplicationVersionInterface */
+class NsVersionSession : public NsPooledSession {
+  public:
+    NsVersionSession();
+};
+
+NsSessionPoolStats nsGetVersionSessionStats();
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Where the app keeps its files. The host build keeps them in a local directory. */
+#ifndef CONFIG_DIRECTORY
+#define CONFIG_DIRECTORY "sdmc:/config/UpThemAll/"
+#endif
+
+/* Queue journal and caches of a replayed or simulated system are kept apart from the real ones. */
+#if defined(IPC_REPLAY) || defined(IPC_SIMULATE)
+#define STATE_DIRECTORY CONFIG_DIRECTORY "offline/"
+#else
+#define STATE_DIRECTORY CONFIG_DIRECTORY
+#endif
@@ -0,0 +1,649 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "update_queue.hpp"
+
+#include "async_wait.hpp"
+#include "file_util.hpp"
+#include "ns.h"
+#include "paths.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+/* How often running requests check for cancellation and new jobs. */
+constexpr u64 CancelPollInterval = 100'000'000;
+
+/* Requests the system hasn't completed after this long are cancelled and retried. */
+constexpr u64 UpdateTimeoutNs = 1'200'000'000'000;
+
+/* Delay before the first retry, doubled for every further attempt. */
+constexpr u64 RetryBackoffNs = 5'000'000'000;
+
+/* The system auto updater is polled through the application records, which change as titles download and install. */
+constexpr u64 BulkPollIntervalNs = 2'000'000'000;
+
+/* Titles the auto updater hasn't finished after this long without progress are requested one by one. */
+constexpr u64 BulkTimeoutNs = 300'000'000'000;
+
+constexpr size_t BulkRecordBatchSize = 0x400;
+
+/* A finished request only means the system accepted it. Its title is checked this often until the patch shows up. */
+constexpr u64 InstallPollIntervalNs = 2'000'000'000;
+
+/* Titles whose patch didn't show up after this long are left to the next scan. */
+constexpr u64 InstallTimeoutNs = 3'600'000'000'000;
+
+constexpr const char *JournalPath = STATE_DIRECTORY "queue.bin";
+constexpr u32 JournalMagic   = 0x51415455; /* UTAQ */
+constexpr u32 JournalVersion = 2;
+
+struct JournalHeader {
+    u32 magic;
+    u32 version;
+    u32 count;
+    u32 reserved;
+};
+
+struct JournalEntry {
+    u64 application_id;
+    u32 attempts;
+    u32 target;
+    u8 bulk;
+    u8 reserved[3];
+    u32 name_size;
+};
+
+struct JournalRecord {
+    ApplicationId application_id;
+    u32 attempts;
+    u32 target;
+    bool bulk;
+    std::string name;
+};
+
+void SaveJournal(const std::vector<JournalRecord> &records) {
+    CreateParentDirectories(JournalPath);
+
+    auto file = std::fopen(TemporaryPath(JournalPath).c_str(), "wb");
+    if (file == nullptr)
+        return;
+
+    const JournalHeader header = {
+        .magic   = JournalMagic,
+        .version = JournalVersion,
+        .count   = static_cast<u32>(records.size()),
+    };
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (const auto &record: records) {
+        const JournalEntry entry = {
+            .application_id = record.application_id,
+            .attempts       = record.attempts,
+            .target         = record.target,
+            .bulk           = record.bulk,
+            .name_size      = static_cast<u32>(record.name.size()),
+        };
+        ok = ok && std::fwrite(&entry, sizeof(entry), 1, file) == 1
+            && std::fwrite(record.name.data(), 1, record.name.size(), file) == record.name.size();
+    }
+
+    CommitFile(file, ok, JournalPath);
+}
+
+}
+
+float UpdateProgress::Throughput() const noexcept {
+    const u64 elapsed_ns = armTicksToNs(armGetSystemTick() - this->start_tick);
+    return elapsed_ns != 0 ? this->finished * 1'000'000'000.f / elapsed_ns : 0.f;
+}
+
+/* The journal is only loaded here, its jobs wait for Resume. */
+UpdateQueue::UpdateQueue(UpdateVerifier verifier) : verifier(std::move(verifier)) {
+    this->LoadJournal();
+    this->thread = std::thread(&UpdateQueue::ThreadFunc, this);
+}
+
+UpdateQueue::~UpdateQueue() {
+    /* Requests in flight are aborted but stay in the journal to be resumed. */
+    {
+        std::scoped_lock lk(this->mutex);
+        this->exit = true;
+    }
+    this->condvar.notify_all();
+    this->thread.join();
+}
+
+/* Queue an update. Returns false if the application already has a pending job. */
+bool UpdateQueue::Push(ApplicationId application_id, std::string name, u32 target, bool bulk) {
+    {
+        std::scoped_lock lk(this->mutex);
+        if (this->active.contains(application_id))
+            return false;
+
+        /* Start counting from zero once everything before has finished. */
+        if (!this->progress.busy)
+            this->progress = { .start_tick = armGetSystemTick() };
+
+        this->active[application_id] = { .application_id = application_id, .name = std::move(name), .state = UpdateState::Queued, .target = target };
+        if (bulk)
+            this->bulk[application_id] = std::nullopt;
+        else
+            this->queue.push_back(application_id);
+        this->progress.total++;
+        this->progress.busy = true;
+        this->journal_dirty = true;
+    }
+    this->condvar.notify_one();
+    return true;
+}
+
+/* Queue the jobs loaded from the journal, except the ones done reports as having nothing left to do. Returns how many were queued. */
+u32 UpdateQueue::Resume(const std::function<bool(ApplicationId application_id, u32 target)> &done) {
+    u32 resumed = 0;
+    {
+        std::scoped_lock lk(this->mutex);
+
+        for (auto &[job, bulk]: this->journaled) {
+            const auto application_id = job.application_id;
+            if (this->active.contains(application_id) || done(application_id, job.target))
+                continue;
+
+            if (!this->progress.busy)
+                this->progress = { .start_tick = armGetSystemTick() };
+
+            this->active[application_id] = std::move(job);
+            if (bulk)
+                this->bulk[application_id] = std::nullopt;
+            else
+                this->queue.push_back(application_id);
+            this->progress.total++;
+            this->progress.busy = true;
+            resumed++;
+        }
+
+        this->journaled.clear();
+        this->journal_dirty = true;
+    }
+    this->condvar.notify_one();
+    return resumed;
+}
+
+/* Drop every queued job and abort the ones in flight. */
+void UpdateQueue::Cancel() {
+    {
+        std::scoped_lock lk(this->mutex);
+
+        for (const auto application_id: this->queue) {
+            auto job = std::move(this->active.at(application_id));
+            job.state = UpdateState::Cancelled;
+            job.rc = ResultCancelled;
+            this->Finish(std::move(job));
+        }
+        this->queue.clear();
+
+        /* Stop tracking, the system auto updater can't be called back. */
+        for (const auto &[application_id, record]: this->bulk) {
+            auto job = std::move(this->active.at(application_id));
+            job.state = UpdateState::Cancelled;
+            job.rc = ResultCancelled;
+            this->Finish(std::move(job));
+        }
+        this->bulk.clear();
+        this->bulk_started = false;
+
+        this->cancel_running = true;
+        this->journal_dirty = true;
+    }
+    this->condvar.notify_one();
+}
+
+void UpdateQueue::SetWindow(u32 window) noexcept {
+    this->window = std::clamp<u32>(window, 1, MaxWindow);
+}
+
+std::optional<UpdateState> UpdateQueue::GetState(ApplicationId application_id) const {
+    std::scoped_lock lk(this->mutex);
+
+    if (const auto it = this->active.find(application_id); it != std::cend(this->active))
+        return it->second.state;
+    return std::nullopt;
+}
+
+UpdateProgress UpdateQueue::GetProgress() const {
+    std::scoped_lock lk(this->mutex);
+    auto progress = this->progress;
+    progress.installing = this->installing.size();
+    return progress;
+}
+
+/* Jobs that completed since the last call, in completion order. */
+std::vector<UpdateJob> UpdateQueue::TakeFinished() {
+    std::scoped_lock lk(this->mutex);
+    return std::exchange(this->finished, {});
+}
+
+/* Messages about the queue itself, for the log. */
+std::vector<std::string> UpdateQueue::TakeNotices() {
+    std::scoped_lock lk(this->mutex);
+    return std::exchange(this->notices, {});
+}
+
+void UpdateQueue::ThreadFunc() {
+    std::vector<InFlight> in_flight;
+    in_flight.reserve(MaxWindow);
+
+    std::unique_lock lk(this->mutex);
+
+    while (!this->exit) {
+        this->FlushJournal(lk);
+
+        if (this->cancel_running) {
+            this->cancel_running = false;
+            lk.unlock();
+            for (auto &request: in_flight) {
+                asyncResultCancel(&request.async);
+                this->Complete(request, ResultCancelled);
+            }
+            in_flight.clear();
+            lk.lock();
+        }
+
+        const u64 now = armGetSystemTick();
+        u64 next_ready = UINT64_MAX;
+
+        if (!this->bulk.empty())
+            this->StepBulk(lk, now, next_ready);
+        if (!this->installing.empty())
+            this->StepInstalling(lk, now, next_ready);
+
+        /* Top up the window. Starting a request is quick, only its completion takes long. */
+        while (in_flight.size() < this->window) {
+            const auto application_id = this->PopReady(now, next_ready);
+            if (!application_id.has_value())
+                break;
+
+            auto &job = this->active.at(*application_id);
+            job.state = UpdateState::Running;
+            auto &request = in_flight.emplace_back(InFlight{ .job = job });
+
+            lk.unlock();
+            const Result rc = nsPoolRequestUpdateApplication2(&request.async, request.job.application_id);
+            request.deadline = armGetSystemTick() + armNsToTicks(UpdateTimeoutNs);
+            if (R_FAILED(rc)) {
+                /* Nothing to close, the request was never opened. */
+                request.async = {};
+                this->Complete(request, rc);
+                in_flight.pop_back();
+            }
+            lk.lock();
+        }
+
+        if (in_flight.empty()) {
+            /* Sleep until a job is pushed, a backoff expires, the auto updater is due a poll or we're told to exit. */
+            if (next_ready == UINT64_MAX)
+                this->condvar.wait(lk);
+            else
+                this->condvar.wait_for(lk, std::chrono::nanoseconds(armTicksToNs(next_ready - now)));
+            continue;
+        }
+
+        /* Wait for whichever request completes first. Time out now and then to pick up new jobs. */
+        lk.unlock();
+        std::array<Event *, MaxWindow> events;
+        for (size_t i = 0; i < in_flight.size(); i++)
+            events[i] = &in_flight[i].async.event;
+
+        s32 index = -1;
+        if (R_SUCCEEDED(WaitAnyEvent(&index, events.data(), in_flight.size(), CancelPollInterval, &this->cancel_running)) && index >= 0) {
+            /* Signalled already, this only fetches the result. Past the deadline it is cancelled like the rest below. */
+            auto &request = in_flight[index];
+            const u64 signalled = armGetSystemTick();
+            const u64 remaining_ns = request.deadline > signalled ? armTicksToNs(request.deadline - signalled) : 0;
+            this->Complete(request, WaitAsyncResult(&request.async, remaining_ns, &this->cancel_running));
+            in_flight.erase(std::begin(in_flight) + index);
+        }
+
+        /* A request the system never answers would otherwise hold its slot for good. */
+        std::vector<std::string> timed_out;
+        const u64 after = armGetSystemTick();
+        for (auto it = std::begin(in_flight); it != std::end(in_flight);) {
+            if (after < it->deadline) {
+                it++;
+                continue;
+            }
+            asyncResultCancel(&it->async);
+            timed_out.push_back(it->job.name);
+            this->Complete(*it, ResultTimedOut);
+            it = in_flight.erase(it);
+        }
+        lk.lock();
+
+        for (const auto &name: timed_out) {
+            char notice[0x80];
+            std::snprintf(notice, sizeof(notice), "%s: no answer after %lus, cancelled", name.c_str(), UpdateTimeoutNs / 1'000'000'000);
+            this->notices.push_back(notice);
+        }
+    }
+
+    lk.unlock();
+    for (auto &request: in_flight) {
+        asyncResultCancel(&request.async);
+        asyncResultClose(&request.async);
+    }
+
+    lk.lock();
+    this->FlushJournal(lk);
+}
+
+/* Next queued job whose backoff has expired. Called with the lock held. */
+std::optional<ApplicationId> UpdateQueue::PopReady(u64 now, u64 &next_ready) {
+    for (auto it = std::begin(this->queue); it != std::end(this->queue); it++) {
+        const u64 not_before = this->active.at(*it).not_before;
+        if (not_before <= now) {
+            const auto application_id = *it;
+            this->queue.erase(it);
+            return application_id;
+        }
+        next_ready = std::min(next_ready, not_before);
+    }
+    return std::nullopt;
+}
+
+/* Start the system auto updater or check on it. Called with the lock held. */
+void UpdateQueue::StepBulk(std::unique_lock<std::mutex> &lk, u64 now, u64 &next_ready) {
+    if (!this->bulk_started) {
+        lk.unlock();
+        const Result rc = nsPerformAutoUpdate();
+        lk.lock();
+
+        /* Cancelled while the lock was dropped, nothing left to watch. */
+        if (this->bulk.empty()) {
+            this->bulk_started = false;
+            return;
+        }
+
+        if (R_FAILED(rc)) {
+            this->FallBackFromBulk("System auto update unavailable", rc);
+            return;
+        }
+
+        this->notices.push_back("System auto update started");
+        this->bulk_started = true;
+        this->bulk_next_poll = now;
+        this->bulk_last_progress = now;
+    }
+
+    for (const auto &[application_id, record]: this->bulk)
+        this->active.at(application_id).state = UpdateState::Running;
+
+    if (now < this->bulk_next_poll) {
+        next_ready = std::min(next_ready, this->bulk_next_poll);
+        return;
+    }
+    this->bulk_next_poll = now + armNsToTicks(BulkPollIntervalNs);
+    next_ready = std::min(next_ready, this->bulk_next_poll);
+
+    /* One batched listing tells which tracked titles changed, only those are verified. */
+    auto tracked = this->bulk;
+    lk.unlock();
+
+    std::vector<UpdateJob> changed;
+    for (const auto application_id: this->ListChangedRecords(tracked, false)) {
+        auto &job = changed.emplace_back(UpdateJob{ .application_id = application_id });
+        if (this->verifier)
+            this->verifier(job);
+    }
+
+    lk.lock();
+
+    for (auto &[application_id, record]: this->bulk) {
+        if (const auto it = tracked.find(application_id); it != std::end(tracked))
+            record = it->second;
+    }
+
+    for (auto &result: changed) {
+        const auto it = this->active.find(result.application_id);
+        if (it == std::end(this->active) || !this->bulk.contains(result.application_id))
+            continue;
+
+        this->bulk_last_progress = now;
+        if (!result.verified || result.versions.patch < it->second.target)
+            continue;
+
+        auto job = std::move(it->second);
+        job.state = UpdateState::Done;
+        job.rc = 0;
+        job.verified = true;
+        job.versions = std::move(result.versions);
+        job.required = result.required;
+        this->bulk.erase(job.application_id);
+        this->Finish(std::move(job));
+        this->journal_dirty = true;
+    }
+
+    if (this->bulk.empty()) {
+        this->bulk_started = false;
+    } else if (armTicksToNs(now - this->bulk_last_progress) > BulkTimeoutNs) {
+        this->FallBackFromBulk("System auto update stalled", 0);
+    }
+}
+
+/* Update the records of the tracked titles from one batched listing and return the ones that changed.
+ * Titles without a record yet only get their baseline, unless verify_new is set. Called without the lock held. */
+std::vector<ApplicationId> UpdateQueue::ListChangedRecords(std::unordered_map<ApplicationId, std::optional<NsApplicationRecord>> &tracked, bool verify_new) {
+    std::vector<ApplicationId> changed;
+
+    s32 offset=0, count=0;
+    this->bulk_records.resize(BulkRecordBatchSize);
+    while (R_SUCCEEDED(nsPoolListApplicationRecord(this->bulk_records.data(), this->bulk_records.size(), offset, &count)) && count != 0) {
+        offset += count;
+        for (s32 i = 0; i < count; i++) {
+            const auto &record = this->bulk_records[i];
+            const auto it = tracked.find(record.application_id);
+            if (it == std::end(tracked))
+                continue;
+
+            const bool is_new = !it->second.has_value();
+            if (!is_new && std::memcmp(&*it->second, &record, sizeof(record)) == 0)
+                continue;
+
+            it->second = record;
+            if (!is_new || verify_new)
+                changed.push_back(record.application_id);
+        }
+        if (static_cast<size_t>(count) < this->bulk_records.size())
+            break;
+    }
+    return changed;
+}
+
+/* Verify accepted requests once their record changes. The first look verifies as well,
+ * the patch may have been installed before the request completed. Called with the lock held. */
+void UpdateQueue::StepInstalling(std::unique_lock<std::mutex> &lk, u64 now, u64 &next_ready) {
+    if (now < this->install_next_poll) {
+        next_ready = std::min(next_ready, this->install_next_poll);
+        return;
+    }
+    this->install_next_poll = now + armNsToTicks(InstallPollIntervalNs);
+    next_ready = std::min(next_ready, this->install_next_poll);
+
+    std::unordered_map<ApplicationId, std::optional<NsApplicationRecord>> tracked;
+    for (const auto &[application_id, entry]: this->installing)
+        tracked.emplace(application_id, entry.record);
+    lk.unlock();
+
+    std::vector<UpdateJob> changed;
+    for (const auto application_id: this->ListChangedRecords(tracked, true)) {
+        auto &job = changed.emplace_back(UpdateJob{ .application_id = application_id });
+        if (this->verifier)
+            this->verifier(job);
+    }
+
+    lk.lock();
+
+    for (auto &[application_id, entry]: this->installing) {
+        if (const auto it = tracked.find(application_id); it != std::end(tracked))
+            entry.record = it->second;
+    }
+
+    for (auto &job: changed) {
+        const auto it = this->installing.find(job.application_id);
+        if (it == std::end(this->installing) || !job.verified || job.versions.patch < it->second.target)
+            continue;
+
+        job.name = std::move(it->second.name);
+        job.target = it->second.target;
+        job.state = UpdateState::Installed;
+        this->installing.erase(it);
+        this->finished.push_back(std::move(job));
+    }
+
+    for (auto it = std::begin(this->installing); it != std::end(this->installing);) {
+        if (now < it->second.deadline) {
+            it++;
+            continue;
+        }
+        /* Reported as failed so the title can be requested again, the request was already counted. */
+        this->finished.push_back({ .application_id = it->first, .name = std::move(it->second.name), .state = UpdateState::Failed, .rc = ResultTimedOut, .target = it->second.target });
+        it = this->installing.erase(it);
+    }
+}
+
+/* Request whatever the auto updater didn't get to one title at a time. Called with the lock held. */
+void UpdateQueue::FallBackFromBulk(const char *reason, Result rc) {
+    char notice[0x80];
+    std::snprintf(notice, sizeof(notice), "%s (0x%x), requesting %zu titles one by one", reason, rc, this->bulk.size());
+    this->notices.push_back(notice);
+
+    for (const auto &[application_id, record]: this->bulk) {
+        this->active.at(application_id).state = UpdateState::Queued;
+        this->queue.push_back(application_id);
+    }
+    this->bulk.clear();
+    this->bulk_started = false;
+}
+
+/* Close a started request and record its result. Called without the lock held. */
+void UpdateQueue::Complete(InFlight &request, Result rc) {
+    if (serviceIsActive(&request.async.s))
+        asyncResultClose(&request.async);
+
+    auto job = std::move(request.job);
+    job.rc = rc;
+    job.attempts++;
+
+    /* Failed requests are retried with exponential backoff. */
+    const bool retry = R_FAILED(rc) && rc != ResultCancelled && job.attempts < MaxAttempts;
+
+    std::scoped_lock lk(this->mutex);
+
+    if (retry && !this->exit) {
+        const u64 delay_ns = RetryBackoffNs << (job.attempts - 1);
+        auto &active = this->active.at(job.application_id);
+        active.state = UpdateState::Queued;
+        active.rc = rc;
+        active.attempts = job.attempts;
+        active.not_before = armGetSystemTick() + armNsToTicks(delay_ns);
+        this->queue.push_back(job.application_id);
+        this->journal_dirty = true;
+
+        job.state = UpdateState::Retrying;
+        this->finished.push_back(std::move(job));
+        this->condvar.notify_one();
+        return;
+    }
+
+    /* Shutting down, keep the job journaled so it is resumed on the next launch. */
+    if (this->exit)
+        return;
+
+    /* Accepted, the download only starts now. Watched until the patch is installed. */
+    if (R_SUCCEEDED(rc)) {
+        job.state = UpdateState::Done;
+        this->installing[job.application_id] = { .name = job.name, .target = job.target, .deadline = armGetSystemTick() + armNsToTicks(InstallTimeoutNs) };
+        this->install_next_poll = 0;
+    } else if (rc == ResultCancelled)
+        job.state = UpdateState::Cancelled;
+    else
+        job.state = UpdateState::Failed;
+
+    this->Finish(std::move(job));
+    this->journal_dirty = true;
+}
+
+/* Called with the lock held. */
+void UpdateQueue::Finish(UpdateJob &&job) {
+    this->active.erase(job.application_id);
+    this->progress.finished++;
+    if (job.state != UpdateState::Done)
+        this->progress.failed++;
+    this->progress.busy = this->progress.finished < this->progress.total;
+    this->finished.push_back(std::move(job));
+}
+
+/* Queue jobs left over from the last run. */
+void UpdateQueue::LoadJournal() {
+    auto file = std::fopen(JournalPath, "rb");
+    if (file == nullptr)
+        return;
+
+    JournalHeader header = {};
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == JournalMagic && header.version == JournalVersion;
+
+    for (u32 i = 0; ok && i < header.count; i++) {
+        JournalEntry entry = {};
+        ok = std::fread(&entry, sizeof(entry), 1, file) == 1 && entry.name_size <= sizeof(NacpLanguageEntry::name);
+        if (!ok)
+            break;
+
+        std::string name(entry.name_size, '\0');
+        ok = std::fread(name.data(), 1, name.size(), file) == name.size();
+        if (!ok)
+            continue;
+
+        this->journaled.push_back({
+            .job  = { .application_id = entry.application_id, .name = std::move(name), .state = UpdateState::Queued, .attempts = entry.attempts, .target = entry.target },
+            .bulk = entry.bulk != 0,
+        });
+    }
+
+    std::fclose(file);
+}
+
+/* Write the journal if it changed. Called with the lock held, which is dropped while writing. */
+void UpdateQueue::FlushJournal(std::unique_lock<std::mutex> &lk) {
+    if (!this->journal_dirty)
+        return;
+    this->journal_dirty = false;
+
+    std::vector<JournalRecord> records;
+    records.reserve(this->active.size() + this->journaled.size());
+    for (const auto &[application_id, job]: this->active)
+        records.push_back({ application_id, job.attempts, job.target, this->bulk.contains(application_id), job.name });
+    for (const auto &[job, bulk]: this->journaled)
+        records.push_back({ job.application_id, job.attempts, job.target, bulk, job.name });
+
+    lk.unlock();
+    SaveJournal(records);
+    lk.lock();
+}
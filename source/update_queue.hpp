@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2020-2021 Luis Scheurenbrand
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <switch.h>
+
+#include "application.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+enum class UpdateState {
+    Queued,
+    Running,
+    Done,
+    Failed,
+    /* Failed, but queued again after a backoff. */
+    Retrying,
+    Cancelled,
+    /* The patch of a request that was Done has shown up. */
+    Installed,
+};
+
+struct UpdateJob {
+    ApplicationId application_id;
+    std::string name;
+    UpdateState state;
+    Result rc;
+    u32 attempts;
+    /* Not started again before this tick. */
+    u64 not_before;
+    /* Patch version that counts as updated. */
+    u32 target;
+
+    /* Versions queried once the patch showed up. */
+    bool verified;
+    InstalledVersions versions;
+    u32 required;
+};
+
+/* Re-queries the versions of an application once its records changed after a request. Runs on the update thread. */
+using UpdateVerifier = std::function<void(UpdateJob &job)>;
+
+/* Counters for the UI, all jobs since the queue last ran empty. */
+struct UpdateProgress {
+    u32 total;
+    u32 finished;
+    u32 failed;
+    bool busy;
+    /* Done requests whose patch hasn't shown up yet. */
+    u32 installing;
+    u64 start_tick;
+
+    /* Finished titles per second. */
+    float Throughput() const noexcept;
+};
+
+/* Issues update requests on a background thread so the UI keeps rendering.
+ * Up to window requests are kept in flight and waited on together. Pending
+ * jobs are journaled to the SD card and resumed through Resume on the next launch.
+ * Bulk jobs are handed to the system auto updater with a single request
+ * instead, and fall back to per title requests if that doesn't work out. */
+class UpdateQueue {
+  public:
+    static constexpr u32 MaxWindow = 8;
+    static constexpr u32 MaxAttempts = 5;
+
+  private:
+    struct InFlight {
+        UpdateJob job;
+        AsyncResult async;
+        /* Cancelled if it hasn't completed by this tick. */
+        u64 deadline;
+    };
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable condvar;
+
+    /* Every queued or running job, queue holds the ones waiting to start. */
+    std::unordered_map<ApplicationId, UpdateJob> active;
+    std::deque<ApplicationId> queue;
+    std::vector<UpdateJob> finished;
+    std::vector<std::string> notices;
+
+    /* Loaded from the journal, waiting for Resume. Kept in the journal until then. */
+    struct Journaled {
+        UpdateJob job;
+        bool bulk;
+    };
+    std::vector<Journaled> journaled;
+
+    /* Titles left to the system auto updater, with their record when last polled. Empty until the first poll saw it. */
+    std::unordered_map<ApplicationId, std::optional<NsApplicationRecord>> bulk;
+    bool bulk_started = false;
+    u64 bulk_next_poll = 0, bulk_last_progress = 0;
+    std::vector<NsApplicationRecord> bulk_records;
+
+    /* Accepted requests, watched until the installed patch reaches the target. */
+    struct Installing {
+        std::string name;
+        u32 target;
+        std::optional<NsApplicationRecord> record;
+        u64 deadline;
+    };
+    std::unordered_map<ApplicationId, Installing> installing;
+    u64 install_next_poll = 0;
+    UpdateProgress progress = {};
+
+    bool exit = false;
+    /* Written by the worker outside the lock, once however many changes piled up. */
+    bool journal_dirty = false;
+    /* Also wakes the worker from waiting on requests in flight. */
+    std::atomic_bool cancel_running = false;
+    UpdateVerifier verifier;
+    std::atomic<u32> window = 4;
+
+  public:
+    explicit UpdateQueue(UpdateVerifier verifier);
+    ~UpdateQueue();
+
+    bool Push(ApplicationId application_id, std::string name, u32 target, bool bulk = false);
+    u32 Resume(const std::function<bool(ApplicationId application_id, u32 target)> &done);
+    void Cancel();
+
+    void SetWindow(u32 window) noexcept;
+
+    u32 GetWindow() const noexcept {
+        return this->window;
+    }
+
+    std::optional<UpdateState> GetState(ApplicationId application_id) const;
+    UpdateProgress GetProgress() const;
+    std::vector<UpdateJob> TakeFinished();
+    std::vector<std::string> TakeNotices();
+
+  private:
+    void ThreadFunc();
+    std::optional<ApplicationId> PopReady(u64 now, u64 &next_ready);
+    void StepBulk(std::unique_lock<std::mutex> &lk, u64 now, u64 &next_ready);
+    void StepInstalling(std::unique_lock<std::mutex> &lk, u64 now, u64 &next_ready);
+    std::vector<ApplicationId> ListChangedRecords(std::unordered_map<ApplicationId, std::optional<NsApplicationRecord>> &tracked, bool verify_new);
+    void FallBackFromBulk(const char *reason, Result rc);
+    void Complete(InFlight &request, Result rc);
+    void Finish(UpdateJob &&job);
+
+    void LoadJournal();
+    void FlushJournal(std::unique_lock<std::mutex> &lk);
+};
@@ -19,110 +19,731 @@
 #include "gfx.hpp"
 #include <stb_image.h>
 
+#include "async_wait.hpp"
 #include "ns.h"
+#include "ns_session.hpp"
+#include "paths.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+/* Application records fetched per nsPoolListApplicationRecord call. */
+constexpr size_t RecordBatchSize = 0x400;
+
+/* Update size estimate for titles without a patch installed, as a fraction of the application. */
+constexpr s64 FirstPatchFraction = 4;
+
+/* Content meta statuses fetched per nsListApplicationContentMetaStatus call. */
+constexpr size_t MetaStatusBatchSize = 0x100;
+
+/* Asking the server for a new version list more often than this is pointless. */
+constexpr u64 VersionListRateLimitNs = 300'000'000'000;
+
+/* A version list download that takes longer than this is given up on. */
+constexpr u64 DownloadTimeoutNs = 60'000'000'000;
+
+/* Without RequestVersionListData the stored list is checked this often after RequestVersionList,
+ * and assumed to be unchanged if it didn't change after StoredListTimeoutNs. */
+constexpr u64 VersionListPollNs = 500'000'000;
+constexpr u64 StoredListTimeoutNs = 15'000'000'000;
+
+/* Reported for version list data that couldn't be parsed. */
+constexpr Result ResultBadVersionListData = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+constexpr const char *MetadataCachePath = STATE_DIRECTORY "metadata.bin";
+
+/* Read a number or a quoted hex string following key in a JSON object. */
+bool JsonNumber(std::string_view object, std::string_view key, u64 &value, int base = 10) {
+    const size_t at = object.find(key);
+    if (at == std::string_view::npos)
+        return false;
+    size_t pos = object.find(':', at + key.size());
+    if (pos != std::string_view::npos)
+        pos = object.find_first_not_of(" \t\r\n\"", pos + 1);
+    if (pos == std::string_view::npos)
+        return false;
+    return std::from_chars(object.data() + pos, object.data() + object.size(), value, base).ec == std::errc();
+}
+
+/* The version list data is the server's JSON, {"last_modified": <time>, "titles": [{"id": "<hex>", "version": <n>, "required_version": <n>}, ...]}. */
+bool ParseVersionListData(std::string_view data, u64 &timestamp, std::vector<AvmVersionListEntry> &entries) {
+    timestamp = 0;
+    JsonNumber(data, "\"last_modified\"", timestamp);
+
+    size_t pos = data.find("\"titles\"");
+    if (pos != std::string_view::npos)
+        pos = data.find('[', pos);
+    if (pos == std::string_view::npos)
+        return false;
+
+    while (true) {
+        const size_t begin = data.find_first_of("{]", pos);
+        if (begin == std::string_view::npos)
+            return false;
+        if (data[begin] == ']')
+            break;
+        const size_t end = data.find('}', begin);
+        if (end == std::string_view::npos)
+            return false;
+
+        const auto object = data.substr(begin, end - begin);
+        u64 id = 0, version = 0, required = 0;
+        if (!JsonNumber(object, "\"id\"", id, 16) || !JsonNumber(object, "\"version\"", version))
+            return false;
+        JsonNumber(object, "\"required_version\"", required);
+
+        /* Entries are keyed by patch id, whichever id the server lists. */
+        entries.push_back({ .application_id = id | 0x800, .version = static_cast<u32>(version), .required = static_cast<u32>(required) });
+        pos = end + 1;
+    }
+    return !entries.empty();
+}
+
+/* Store a downloaded list the way the system does. NS's own UpdateVersionList is the fallback when AVM isn't there. */
+Result ImportVersionList(u64 timestamp, std::vector<AvmVersionListEntry> &entries) {
+    AvmVersionListImporter importer = {};
+    Result rc = avmGetVersionListImporter(&importer);
+    if (R_SUCCEEDED(rc)) {
+        rc = avmVersionListImporterSetTimestamp(&importer, timestamp);
+        if (R_SUCCEEDED(rc))
+            rc = avmVersionListImporterSetData(&importer, entries.data(), entries.size());
+        if (R_SUCCEEDED(rc))
+            rc = avmVersionListImporterFlush(&importer);
+        avmVersionListImporterClose(&importer);
+        if (R_SUCCEEDED(rc))
+            return rc;
+    }
+    return nsUpdateVersionList(entries.data(), entries.size());
+}
+
+/* Sort entries by id for FindEntry. */
+template<typename Entry>
+void SortEntries(std::vector<Entry> &entries) {
+    std::stable_sort(std::begin(entries), std::end(entries), [](const auto &lhs, const auto &rhs) {
+        return lhs.application_id < rhs.application_id;
+    });
+}
+
+/* Binary search a sorted entry list. nullptr if not found. */
+template<typename Entry>
+const Entry *FindEntry(const std::vector<Entry> &entries, u64 id) {
+    const auto it = std::lower_bound(std::cbegin(entries), std::cend(entries), id, [](const auto& entry, u64 id) { return entry.application_id < id; });
+    if (it != std::cend(entries) && it->application_id == id)
+        return &*it;
+    return nullptr;
+}
+
+/* Application ids of entries that were added, removed or modified between two sorted lists. */
+template<typename Entry>
+void DiffEntries(const std::vector<Entry> &previous, const std::vector<Entry> &current, std::unordered_set<ApplicationId> &changed) {
+    /* Patch entries are keyed by patch id. */
+    constexpr auto ToApplicationId = [](u64 id) -> ApplicationId { return id & ~u64(0x800); };
+
+    auto lhs = std::cbegin(previous), rhs = std::cbegin(current);
+    while (lhs != std::cend(previous) || rhs != std::cend(current)) {
+        if (rhs == std::cend(current) || (lhs != std::cend(previous) && lhs->application_id < rhs->application_id)) {
+            changed.insert(ToApplicationId((lhs++)->application_id));
+        } else if (lhs == std::cend(previous) || rhs->application_id < lhs->application_id) {
+            changed.insert(ToApplicationId((rhs++)->application_id));
+        } else {
+            if (std::memcmp(&*lhs, &*rhs, sizeof(Entry)) != 0)
+                changed.insert(ToApplicationId(rhs->application_id));
+            lhs++, rhs++;
+        }
+    }
+}
 
-VersionList::VersionList() {
+}
+
+VersionList::VersionList(size_t scan_workers) : metadata_cache(MetadataCachePath), scan_workers(std::max<size_t>(scan_workers, 1)), updates([this](UpdateJob &job) { this->VerifyUpdate(job); }) {
+    /* Titles whose record didn't change since the last launch are not queried again. */
+    this->metadata_cache.Load();
     this->Refresh();
 }
 
-void VersionList::Refresh() {
-    this->impl.resize(0x4000);
+VersionList::~VersionList() {
+    this->scan_cancel = true;
+    if (this->scan_thread.joinable())
+        this->scan_thread.join();
+
+    /* Persist icons fetched since the last scan. */
+    this->metadata_cache.RefreshControls(this->control_cache);
+    if (this->metadata_cache.IsDirty())
+        this->metadata_cache.Save();
+}
+
+/* Start a scan in the background. Results show up through Poll as they come in.
+ * With download set, a fresh version list is requested from the server first. */
+void VersionList::Refresh(bool download) {
+    if (download) {
+        const u64 now = armGetSystemTick();
+        if (this->downloading || (this->rescan_download && this->scanning)) {
+            this->log.appendf("Version list download already in progress\n");
+            download = false;
+        } else if (this->last_download_tick != 0 && armTicksToNs(now - this->last_download_tick) < VersionListRateLimitNs) {
+            this->log.appendf("Version list was downloaded %lus ago, using the local copy\n", armTicksToNs(now - this->last_download_tick) / 1'000'000'000);
+            download = false;
+        } else {
+            this->last_download_tick = now;
+        }
+    }
+
+    if (this->scanning) {
+        this->rescan = true;
+        this->rescan_download |= download;
+        return;
+    }
+
+    this->StartScan(download);
+}
+
+void VersionList::StartScan(bool download) {
+    if (this->scan_thread.joinable())
+        this->scan_thread.join();
+
+    /* The scan thread must not touch state owned by the UI thread. */
+    std::unordered_set<ApplicationId> known;
+    for (const auto &[application_id, versions]: this->installed)
+        known.insert(application_id);
+
+    this->scanning = true;
+    this->scan_done = 0;
+    this->scan_total = 0;
+    this->downloading = download;
+    this->scan_thread = std::thread([this, known = std::move(known), download] {
+        this->Scan(known, download);
+    });
+}
+
+/* Apply scan results on the UI thread. Called every frame. */
+void VersionList::Poll() {
+    std::vector<ScanResult> results;
+    std::vector<ApplicationId> seen;
+    bool finished = false;
+    {
+        std::scoped_lock lk(this->scan_mutex);
+        results = std::move(this->pending);
+        this->pending.clear();
+        if (!this->scan_log.empty()) {
+            this->log.append(this->scan_log.data(), this->scan_log.data() + this->scan_log.size());
+            this->scan_log.clear();
+        }
+        if ((finished = this->scan_finished)) {
+            seen = std::move(this->scan_seen);
+            this->scan_finished = false;
+        }
+    }
+
+    if (!results.empty())
+        this->plan_dirty = true;
+
+    for (auto &result: results) {
+        const auto application_id = result.application_id;
+        const u32 installed = result.versions.patch;
+        this->installed[application_id] = std::move(result.versions);
+
+        /* Check if latest version is already installed. */
+        if (installed >= result.available && installed >= result.required) {
+            this->available.erase(application_id);
+            continue;
+        }
+
+        this->log.appendf("Adding: %s, installed: %d, available: %d\n", result.name.c_str(), installed, result.available);
+
+        /* Titles already listed keep their queue state, only what the scan found is updated. */
+        auto &entry = this->available[application_id];
+        /* A newer version than the one requested needs another request. */
+        if (entry.available != result.available)
+            entry.requested = false;
+        entry.name           = std::move(result.name);
+        entry.required       = result.required > installed;
+        entry.recency        = result.recency;
+        entry.installed      = installed;
+        entry.available      = result.available;
+        entry.storage        = result.storage;
+        entry.required_space = result.required_space;
+    }
+
+    for (const auto &notice: this->updates.TakeNotices())
+        this->log.appendf("%s\n", notice.c_str());
+
+    for (const auto &job: this->updates.TakeFinished()) {
+        switch (job.state) {
+            case UpdateState::Done:
+                /* Requests are only accepted here, the patch is installed later. Bulk updates are verified already. */
+                if (!job.verified) {
+                    this->log.appendf("Requested: [%016lX]: %s\n", job.application_id, job.name.c_str());
+                    if (const auto it = this->available.find(job.application_id); it != std::end(this->available))
+                        it->second.requested = true;
+                    break;
+                }
+                [[fallthrough]];
+            case UpdateState::Installed:
+                this->log.appendf("Updated: [%016lX]: %s\n", job.application_id, job.name.c_str());
+                this->control_cache.Invalidate(job.application_id);
+                break;
+            case UpdateState::Retrying:
+                this->log.appendf("Update failed: [%016lX]: %s: 0x%x, retrying (attempt %u of %u)\n", job.application_id, job.name.c_str(), job.rc, job.attempts + 1, UpdateQueue::MaxAttempts);
+                break;
+            case UpdateState::Cancelled:
+                this->log.appendf("Update cancelled: [%016lX]: %s\n", job.application_id, job.name.c_str());
+                break;
+            default:
+                this->log.appendf("Update failed: [%016lX]: %s: 0x%x\n", job.application_id, job.name.c_str(), job.rc);
+                if (const auto it = this->available.find(job.application_id); it != std::end(this->available))
+                    it->second.requested = false;
+                break;
+        }
+
+        if (job.verified)
+            this->ApplyVerification(job);
+    }
+
+    if (!finished)
+        return;
+
+    /* Drop applications that are gone or no longer eligible. Titles that weren't evaluated may have moved in the record list. */
+    std::unordered_map<ApplicationId, u32> recency;
+    for (u32 i = 0; i < seen.size(); i++)
+        recency.emplace(seen[i], i);
+    std::erase_if(this->installed, [&](const auto &pair) { return !recency.contains(pair.first); });
+    std::erase_if(this->available, [&](const auto &pair) { return !recency.contains(pair.first); });
+    for (auto &[application_id, entry]: this->available)
+        entry.recency = recency.at(application_id);
+    if (!this->available.contains(this->selected))
+        this->selected = 0;
+    this->plan_dirty = true;
+
+    /* Journaled updates wait for a scan, which tells which of them got installed meanwhile, while online. */
+    if (this->resume_pending && this->online) {
+        this->resume_pending = false;
+        const u32 resumed = this->updates.Resume([this](ApplicationId application_id, u32 target) {
+            const auto it = this->installed.find(application_id);
+            return it == std::end(this->installed) || it->second.patch >= target;
+        });
+        if (resumed != 0)
+            this->log.appendf("Resuming %u queued updates\n", resumed);
+    }
+
+    /* Already rate limited when it was requested. */
+    if (this->rescan) {
+        this->rescan = false;
+        this->StartScan(std::exchange(this->rescan_download, false));
+    }
+}
+
+/* Runs on the update thread once the records of a title changed. An update doesn't change the version list, only installed and required versions are queried again. */
+void VersionList::VerifyUpdate(UpdateJob &job) const noexcept {
+    std::vector<NsApplicationContentMetaStatus> buffer;
+    job.versions = QueryInstalledVersions(job.application_id, buffer);
+
+    /* Same source as the scan, but a fresh copy of the table, the scan thread may be replacing it. */
+    std::vector<AvmRequiredVersionEntry> required_versions(0x4000);
     u32 count=0;
-    nsListVersionList(this->impl.data(), this->impl.size(), &count);
-    this->impl.resize(count);
+    job.required = 0;
+    this->ipc.launch_required_version++;
+    if (R_SUCCEEDED(nsListRequiredVersion(required_versions.data(), required_versions.size(), &count))) {
+        const auto it = std::find_if(std::begin(required_versions), std::begin(required_versions) + count,
+            [&](const auto &entry) { return entry.application_id == job.application_id; });
+        if (it != std::begin(required_versions) + count)
+            job.required = it->version;
+    } else {
+        nsGetLaunchRequiredVersion(job.application_id, &job.required);
+    }
 
-    this->UpdateAvailable();
+    job.verified = true;
 }
 
-/* Get installed version. 0 if no patch is installed. */
-u32 VersionList::GetInstalledVersion(ApplicationId application_id) const noexcept {
+/* Update the row of a title that was just updated in place instead of scanning again. */
+void VersionList::ApplyVerification(const UpdateJob &job) {
+    const auto application_id = job.application_id;
+    const u32 installed = job.versions.patch;
+    this->installed[application_id] = job.versions;
+
+    const auto it = this->available.find(application_id);
+    if (it == std::end(this->available))
+        return;
+
+    auto &entry = it->second;
+    this->plan_dirty = true;
+
+    if (installed >= entry.available && installed >= job.required) {
+        this->log.appendf("Up to date: %s, installed: %d\n", entry.name.c_str(), installed);
+        this->available.erase(it);
+        return;
+    }
+
+    entry.installed = installed;
+    entry.required = job.required > installed;
+    entry.requested |= job.state == UpdateState::Done || job.state == UpdateState::Installed;
+}
+
+void VersionList::ScanLog(const char *format, ...) {
+    char buffer[0x200];
+    std::va_list args;
+    va_start(args, format);
+    std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    std::scoped_lock lk(this->scan_mutex);
+    this->scan_log += buffer;
+}
+
+void VersionList::Scan(const std::unordered_set<ApplicationId> &known, bool download) {
+    this->ipc.Reset();
+
+    if (download)
+        this->DownloadVersionList();
+
+    /* Keep the previous snapshot so only applications with changed entries are evaluated again. */
+    const auto previous_impl = std::move(this->impl);
+    const auto previous_required_versions = std::move(this->required_versions);
+
+    {
+        /* Read both lists on one session so nothing is pushed in between. */
+        NsVersionSession session;
+
+        this->impl.resize(0x4000);
+        u32 count=0;
+        nsListVersionList(this->impl.data(), this->impl.size(), &count);
+        this->impl.resize(count);
+
+        /* Fetch every launch required version at once instead of one call per application. */
+        this->required_versions.resize(0x4000);
+        count = 0;
+        this->ipc.launch_required_version++;
+        this->required_versions_loaded = R_SUCCEEDED(nsListRequiredVersion(this->required_versions.data(), this->required_versions.size(), &count));
+        this->required_versions.resize(this->required_versions_loaded ? count : 0);
+    }
+
+    /* Sort by id so lookups can binary search instead of scanning every entry. */
+    SortEntries(this->impl);
+    SortEntries(this->required_versions);
+
+    std::unordered_set<ApplicationId> changed;
+    DiffEntries(previous_impl, this->impl, changed);
+    DiffEntries(previous_required_versions, this->required_versions, changed);
+
+    auto seen = this->ScanApplications(known, changed);
+
+    std::scoped_lock lk(this->scan_mutex);
+    this->scan_seen = std::move(seen);
+    this->scan_finished = !this->scan_cancel;
+    this->scanning = false;
+}
+
+/* Get base, patch and add-on versions from one buffered meta status listing. */
+InstalledVersions VersionList::QueryInstalledVersions(ApplicationId application_id, std::vector<NsApplicationContentMetaStatus> &buffer) const noexcept {
+    InstalledVersions versions = {};
     s32 index=0, count=0;
-    NsApplicationContentMetaStatus meta={};
-    while (R_SUCCEEDED(nsListApplicationContentMetaStatus(application_id, index++, &meta, 1, &count)) && count != 0) {
-        if (meta.meta_type == NcmContentMetaType_Patch) {
-            return meta.version;
+    buffer.resize(MetaStatusBatchSize);
+    while (this->ipc.content_meta_status++, R_SUCCEEDED(nsPoolListApplicationContentMetaStatus(application_id, index, buffer.data(), buffer.size(), &count)) && count != 0) {
+        index += count;
+
+        for (const auto &meta: std::span(buffer.data(), count)) {
+            switch (meta.meta_type) {
+                case NcmContentMetaType_Application:
+                    versions.application = meta.version;
+                    break;
+                case NcmContentMetaType_Patch:
+                    versions.patch = meta.version;
+                    break;
+                case NcmContentMetaType_AddOnContent:
+                    versions.add_ons.emplace_back(meta.application_id, meta.version);
+                    break;
+                default:
+                    break;
+            }
         }
+
+        if (static_cast<size_t>(count) < buffer.size())
+            break;
     }
-    return 0;
+    return versions;
+}
+
+/* Get installed version. 0 if no patch is installed. */
+u32 VersionList::GetInstalledVersion(ApplicationId application_id) const noexcept {
+    if (const auto it = this->installed.find(application_id); it != std::cend(this->installed))
+        return it->second.patch;
+    std::vector<NsApplicationContentMetaStatus> buffer;
+    return QueryInstalledVersions(application_id, buffer).patch;
 }
 
 /* Get highest available version. 0 if not found. */
 u32 VersionList::GetAvailableVersion(ApplicationId application_id) const noexcept {
     u64 patch_id = application_id | 0x800;
-    const auto it = std::find_if(std::cbegin(impl), std::cend(impl), [&](const auto& entry) { return patch_id == entry.application_id; });
-    
-    if (it != std::end(impl)) {
-        return it->version;
+    const auto entry = FindEntry(this->impl, patch_id);
+
+    if (entry != nullptr) {
+        return entry->version;
     } else {
         return 0;
     }
 }
 
 u32 VersionList::GetLaunchRequiredVersion(ApplicationId application_id) const noexcept {
+    /* Prefer the table fetched on Refresh. Applications without an entry have no requirement. */
+    if (this->required_versions_loaded) {
+        const auto entry = FindEntry(this->required_versions, application_id);
+        return entry != nullptr ? entry->version : 0;
+    }
+
     u32 version = 0;
+    this->ipc.launch_required_version++;
     if (R_FAILED(nsGetLaunchRequiredVersion(application_id, &version)))
         return 0;
     return version;
 }
 
-static NsApplicationControlData nacp={};
+std::string VersionList::GetApplicationName(ApplicationId application_id) const noexcept {
+    const auto data = this->control_cache.Get(application_id, false);
+    return data != nullptr ? data->name : std::string();
+}
 
-const char* VersionList::GetApplicationName(ApplicationId application_id) const noexcept {
-    NacpLanguageEntry *entry = &nacp.nacp.lang[0];
-    u64 size=0;
-    nsGetApplicationControlData(NsApplicationControlSource_Storage, application_id, &nacp, sizeof(nacp), &size);
-    nacpGetLanguageEntry(&nacp.nacp, &entry);
-    return entry->name;
+std::shared_ptr<const ControlData> VersionList::GetThumbnail(ApplicationId application_id) noexcept {
+    return this->control_cache.Get(application_id, true);
 }
 
-const u8* VersionList::GetThumbnail(ApplicationId application_id) const noexcept {
-    u64 size=0;
-    nsGetApplicationControlData(NsApplicationControlSource_Storage, application_id, &nacp, sizeof(nacp), &size);
-    return nacp.icon;
+/* Update order: titles that can't be launched first, then the most recently used. Ids break ties so the order is stable. */
+const std::vector<ApplicationId> &VersionList::GetUpdatePlan() noexcept {
+    if (!this->plan_dirty)
+        return this->plan;
+
+    this->plan.clear();
+    for (const auto &[application_id, entry]: this->available)
+        this->plan.push_back(application_id);
+
+    std::sort(std::begin(this->plan), std::end(this->plan), [this](ApplicationId lhs, ApplicationId rhs) {
+        const auto &l = this->available.at(lhs), &r = this->available.at(rhs);
+        return std::tuple(!l.required, l.recency, lhs) < std::tuple(!r.required, r.recency, rhs);
+    });
+
+    this->plan_dirty = false;
+    return this->plan;
 }
 
-bool VersionList::UpdateSynchronous(ApplicationId application_id) const noexcept {
-    this->log.appendf("Updating: [%016lX]: %s\n", application_id, GetApplicationName(application_id));
+bool VersionList::QueueUpdate(ApplicationId application_id, bool bulk) noexcept {
+    const auto it = this->available.find(application_id);
+    if (it == std::end(this->available))
+        return false;
 
-    /* Request update. */
-    AsyncResult async;
-    Result rc = nsRequestUpdateApplication2(&async, application_id);
-    if (R_SUCCEEDED(rc)) {
-        /* Wait for result. */
-        rc = asyncResultGet(&async);
-        asyncResultClose(&async);
+    const auto &name = it->second.name;
+    if (!this->updates.Push(application_id, name, it->second.available, bulk))
+        return false;
+
+    this->log.appendf("Queued update: [%016lX]: %s\n", application_id, name.c_str());
+    return true;
+}
+
+/* Decide what fits before anything is requested, so nothing fails late for lack of space. */
+void VersionList::QueueUpdates(const std::vector<ApplicationId> &application_ids, bool bulk) noexcept {
+    auto budget = QueryUpdateBudget();
+
+    std::vector<ApplicationId> ready;
+    u32 deferred = 0;
+    for (const auto application_id: application_ids) {
+        /* Already counted against the budget. */
+        auto &entry = this->available.at(application_id);
+        if (entry.requested || this->updates.GetState(application_id).has_value())
+            continue;
+
+        if (ReserveSpace(entry, budget))
+            ready.push_back(application_id);
+        else
+            deferred++;
     }
 
-    if (R_FAILED(rc))
-        this->log.appendf("Update failed: 0x%x\n", rc);
+    if (deferred != 0)
+        this->log.appendf("Deferred %u updates for lack of space\n", deferred);
 
-    return R_SUCCEEDED(rc);
+    for (const auto application_id: ready)
+        QueueUpdate(application_id, bulk);
 }
 
 void VersionList::UpdateAllApplications() noexcept {
-    for (const auto &[application_id, pair]: this->available) {
-        UpdateSynchronous(application_id);
+    QueueUpdates(GetUpdatePlan(), this->bulk_update);
+}
+
+/* Estimate the space an update needs from the size of the installed patch, or the application if there is none. 0 if the system doesn't know. */
+void VersionList::EstimateUpdateSize(ApplicationId application_id, NcmStorageId &storage, s64 &size) const noexcept {
+    storage = NcmStorageId_None;
+    size = 0;
+
+    NsApplicationOccupiedSize occupied = {};
+    if (R_FAILED(nsPoolCalculateApplicationOccupiedSize(application_id, &occupied)))
+        return;
+
+    /* Patches are installed next to the application, the old patch stays until the new one is in place. */
+    for (const auto &entity: occupied.layout) {
+        if (entity.sizeApplication == 0 && entity.sizePatch == 0)
+            continue;
+
+        storage = static_cast<NcmStorageId>(entity.storageID);
+        size = entity.sizePatch;
+
+        /* Nothing to go by without a patch, assume the first one is a fraction of the application. */
+        if (size == 0)
+            size = entity.sizeApplication / FirstPatchFraction;
+        break;
+    }
+}
+
+std::unordered_map<NcmStorageId, s64> VersionList::QueryFreeSpace() const noexcept {
+    std::unordered_map<NcmStorageId, s64> free_space;
+    for (const auto storage: { NcmStorageId_BuiltInUser, NcmStorageId_SdCard }) {
+        s64 size = 0;
+        if (R_SUCCEEDED(nsPoolGetFreeSpaceSize(storage, &size)))
+            free_space[storage] = size;
+    }
+    return free_space;
+}
+
+/* Free space minus the estimates of the updates that are queued, running or still downloading, which haven't taken their space yet. */
+std::unordered_map<NcmStorageId, s64> VersionList::QueryUpdateBudget() const noexcept {
+    auto budget = QueryFreeSpace();
+    for (const auto &[application_id, entry]: this->available) {
+        if (!entry.requested && !this->updates.GetState(application_id).has_value())
+            continue;
+        if (const auto it = budget.find(entry.storage); it != std::end(budget))
+            it->second -= entry.required_space;
+    }
+    return budget;
+}
+
+/* Take the estimated size of an update off the free space budget. False if it doesn't fit. */
+bool VersionList::ReserveSpace(ListEntry &entry, std::unordered_map<NcmStorageId, s64> &free_space) noexcept {
+    const auto it = free_space.find(entry.storage);
+
+    /* Unknown storage or size, let the system decide. */
+    if (it == std::end(free_space) || entry.required_space == 0) {
+        entry.deferred = false;
+        return true;
+    }
+
+    if (entry.required_space > it->second) {
+        if (!entry.deferred) {
+            this->log.appendf("Deferred: %s needs %ldMiB on %s, %ldMiB free\n", entry.name.c_str(),
+                entry.required_space >> 20, entry.storage == NcmStorageId_SdCard ? "SD card" : "system memory", it->second >> 20);
+        }
+        entry.deferred = true;
+        return false;
+    }
+
+    it->second -= entry.required_space;
+    entry.deferred = false;
+    return true;
+}
+
+/* Reset the launch required version of every blocked title in one go. */
+void VersionList::ResetAllLaunchVersions() noexcept {
+    std::vector<ApplicationId> application_ids;
+    for (const auto &[application_id, entry]: this->available) {
+        if (entry.required)
+            application_ids.push_back(application_id);
+    }
+
+    if (application_ids.empty())
+        return;
+
+    std::vector<Result> results(application_ids.size());
+    const Result rc = nsPushLaunchVersionBatch(application_ids.data(), application_ids.size(), 0, results.data());
+    if (R_FAILED(rc))
+        this->log.appendf("Failed to open version interface: 0x%x\n", rc);
+
+    for (size_t i = 0; i < application_ids.size(); i++) {
+        auto &entry = this->available.at(application_ids[i]);
+        if (R_FAILED(results[i])) {
+            this->log.appendf("Failed to reset launch required version for %s [%016lX]: 0x%x\n", entry.name.c_str(), application_ids[i], results[i]);
+            continue;
+        }
+
+        this->log.appendf("Reset launch required version for %s [%016lX]\n", entry.name.c_str(), application_ids[i]);
+        entry.required = false;
+        this->plan_dirty = true;
     }
+}
 
-    this->available.clear();
-    this->selected = 0;
+bool VersionList::HasRequiredVersions() const noexcept {
+    return std::any_of(std::cbegin(this->available), std::cend(this->available), [](const auto &pair) { return pair.second.required; });
 }
 
 void VersionList::List(bool has_internet) noexcept {
     static DkResHandle handle = 0;
 
+    this->online = has_internet;
+    this->Poll();
+
+    if (this->downloading) {
+        static constexpr const char Spinner[] = "|/-\\";
+        ImGui::Text("Downloading version list %c", Spinner[static_cast<int>(ImGui::GetTime() * 8) % 4]);
+    } else if (this->scanning) {
+        const u32 done = this->scan_done, total = this->scan_total;
+        char overlay[0x40];
+        std::snprintf(overlay, sizeof(overlay), "Scanning %u/%u", done, total);
+        ImGui::ProgressBar(total != 0 ? static_cast<float>(done) / total : 0.f, ImVec2{-1.f, 0.f}, overlay);
+    }
+
+    if (has_internet) {
+        int window = this->updates.GetWindow();
+        ImGui::SetNextItemWidth(200.f);
+        if (ImGui::SliderInt("Parallel update requests", &window, 1, UpdateQueue::MaxWindow))
+            this->updates.SetWindow(window);
+
+        /* Update All hands everything to the system with a single request. */
+        ImGui::SameLine();
+        ImGui::Checkbox("Use system auto update", &this->bulk_update);
+    }
+
+    if (const auto progress = this->updates.GetProgress(); progress.busy) {
+        if (ImGui::Button("Cancel Updates"))
+            this->updates.Cancel();
+        ImGui::SameLine();
+
+        char overlay[0x60];
+        std::snprintf(overlay, sizeof(overlay), "Updating %u/%u, %u failed, %.2f titles/s", progress.finished, progress.total, progress.failed, progress.Throughput());
+        ImGui::ProgressBar(static_cast<float>(progress.finished) / progress.total, ImVec2{-1.f, 0.f}, overlay);
+    } else if (progress.installing != 0) {
+        ImGui::Text("Waiting for %u requested updates to install", progress.installing);
+    }
+
     if (ImGui::BeginChild("left pane", ImVec2{750.f, 400.f}, true)) {
-        for (const auto &[application_id, pair]: this->available) {
-            const auto &[name, required] = pair;
+        /* Listed in the order Update All would run. */
+        for (const auto application_id: GetUpdatePlan()) {
+            const auto &entry = this->available.at(application_id);
+            const auto &name = entry.name;
+            const bool required = entry.required;
             if (required)
                 ImGui::PushStyleColor(ImGuiCol_Text, ImVec4{0.94f, 0.33f, 0.31f, 1.f});
-            if (ImGui::Selectable(name.c_str(), this->selected == application_id)) {
+            /* Stable id, the label changes with the update state. */
+            char label[0x240];
+            const auto state = this->updates.GetState(application_id);
+            if (state.has_value())
+                std::snprintf(label, sizeof(label), "%s (%s)###%016lX", name.c_str(), *state == UpdateState::Running ? "updating" : "queued", application_id);
+            else if (entry.requested)
+                std::snprintf(label, sizeof(label), "%s (downloading)###%016lX", name.c_str(), application_id);
+            else if (entry.deferred)
+                std::snprintf(label, sizeof(label), "%s (not enough space)###%016lX", name.c_str(), application_id);
+            else
+                std::snprintf(label, sizeof(label), "%s###%016lX", name.c_str(), application_id);
+
+            if (ImGui::Selectable(label, this->selected == application_id)) {
                 if (this->selected != application_id) {
-                    auto jpeg = GetThumbnail(application_id);
+                    auto control = GetThumbnail(application_id);
                     /* Decode image to */
                     int w,h;
-                    auto data = stbi_load_from_memory(jpeg, 0x20000, &w, &h, nullptr, 4);
-                    handle = fz::gfx::create_texture(data, w, h, 1, 1);
+                    auto data = control != nullptr ? stbi_load_from_memory(control->icon.data(), control->icon.size(), &w, &h, nullptr, 4) : nullptr;
+                    handle = data != nullptr ? fz::gfx::create_texture(data, w, h, 1, 1) : 0;
                     free(data);
                     this->selected = application_id;
                 }
@@ -136,14 +757,18 @@ void VersionList::List(bool has_internet) noexcept {
 
     {
         ImGui::BeginGroup();
-        if (this->selected != 0) {
-            if (!this->available.contains(this->selected))
-                this->selected = 0;
+        /* The selected title may have been dropped by a scan. */
+        if (this->selected != 0 && !this->available.contains(this->selected))
+            this->selected = 0;
 
-            auto &[name, required] = this->available.at(this->selected);
+        if (this->selected != 0) {
+            auto &entry = this->available.at(this->selected);
+            const auto &name = entry.name;
+            auto &required = entry.required;
 
             ImGui::BeginChild("item view", ImVec2{0.f, 400.f - ImGui::GetFrameHeightWithSpacing()});
             ImGui::Text(name.c_str());
+            ImGui::Text("Installed: v%u, available: v%u", entry.installed, entry.available);
             ImGui::Separator();
             if (handle != 0) {
                 static auto ImageSize = ImVec2{256.f, 256.f};
@@ -152,12 +777,8 @@ void VersionList::List(bool has_internet) noexcept {
             }
             ImGui::EndChild();
 
-            if (has_internet && ImGui::Button("Update")) {
-                if (UpdateSynchronous(this->selected)) {
-                    this->available.erase(this->selected);
-                    this->selected = 0;
-                }
-            }
+            if (has_internet && ImGui::Button("Update"))
+                QueueUpdates({ this->selected }, false);
             
             if (has_internet && required)
                 ImGui::SameLine();
@@ -166,6 +787,7 @@ void VersionList::List(bool has_internet) noexcept {
                 this->log.appendf("Resetting launch required version for %s [%016lX]", name.c_str(), this->selected);
                 nsPushLaunchVersion(this->selected, 0);
                 required = false;
+                this->plan_dirty = true;
             }
         }
 
@@ -189,32 +811,197 @@ void VersionList::Nuke() noexcept {
     Refresh();
 }
 
-void VersionList::UpdateAvailable() {
-    this->available.clear();
-    this->selected = 0;
+/* Runs on the scan thread. RequestVersionListData hands over the downloaded list, which is imported
+ * before the scan reads it back. Firmware without the command falls back to RequestVersionList. */
+void VersionList::DownloadVersionList() {
+    const u64 start = armGetSystemTick();
+
+    AsyncValue async;
+    Result rc = nsRequestVersionListData(&async);
+    if (R_FAILED(rc)) {
+        this->WaitForStoredVersionList(start);
+        this->downloading = false;
+        return;
+    }
 
-    /* Iterate over installed applications. */
+    /* Exiting or a slow connection must not hold up the scan. */
+    u64 size = 0;
+    std::string data;
+    rc = WaitAsyncValue(&async, DownloadTimeoutNs, &this->scan_cancel, &size);
+    if (R_SUCCEEDED(rc)) {
+        data.resize(size);
+        rc = asyncValueGet(&async, data.data(), data.size());
+    }
+    asyncValueClose(&async);
+
+    u64 timestamp = 0;
+    std::vector<AvmVersionListEntry> entries;
+    if (R_SUCCEEDED(rc) && !ParseVersionListData(data, timestamp, entries))
+        rc = ResultBadVersionListData;
+    if (R_SUCCEEDED(rc))
+        rc = ImportVersionList(timestamp, entries);
+
+    this->downloading = false;
+
+    if (R_SUCCEEDED(rc))
+        this->ScanLog("Downloaded version list with %zu entries in %lums\n", entries.size(), armTicksToNs(armGetSystemTick() - start) / 1'000'000);
+    else if (rc == ResultTimedOut)
+        this->ScanLog("Version list download timed out after %lus\n", DownloadTimeoutNs / 1'000'000'000);
+    else if (rc == ResultCancelled)
+        return;
+    else
+        this->ScanLog("Version list download failed: 0x%x\n", rc);
+}
+
+/* RequestVersionList only starts the download, the system stores the new list itself once it arrives.
+ * Nothing signals that, so the stored list is compared until it changes. */
+void VersionList::WaitForStoredVersionList(u64 start) {
+    std::vector<AvmVersionListEntry> previous(0x4000), current(0x4000);
+    u32 previous_count = 0;
+    nsListVersionList(previous.data(), previous.size(), &previous_count);
+
+    Result rc = nsRequestVersionList();
+    bool changed = false;
+    while (R_SUCCEEDED(rc) && !changed) {
+        s32 index = -1;
+        rc = WaitAnyEvent(&index, nullptr, 0, VersionListPollNs, &this->scan_cancel);
+        if (rc != ResultTimedOut)
+            break;
+
+        u32 count = 0;
+        rc = nsListVersionList(current.data(), current.size(), &count);
+        changed = R_SUCCEEDED(rc) && (count != previous_count || std::memcmp(previous.data(), current.data(), count * sizeof(AvmVersionListEntry)) != 0);
+
+        /* The server may simply have nothing new. */
+        if (!changed && armTicksToNs(armGetSystemTick() - start) >= StoredListTimeoutNs)
+            break;
+    }
+
+    if (rc == ResultCancelled)
+        return;
+    else if (changed)
+        this->ScanLog("Downloaded version list in %lums\n", armTicksToNs(armGetSystemTick() - start) / 1'000'000);
+    else if (R_SUCCEEDED(rc))
+        this->ScanLog("Version list unchanged after %lus\n", StoredListTimeoutNs / 1'000'000'000);
+    else
+        this->ScanLog("Version list download failed: 0x%x\n", rc);
+}
+
+/* Runs on the scan thread. Returns every application that was seen. */
+std::vector<ApplicationId> VersionList::ScanApplications(const std::unordered_set<ApplicationId> &known, const std::unordered_set<ApplicationId> &changed) {
+    struct ScanJob {
+        NsApplicationRecord record;
+        const MetadataCache::Entry *cached;
+        u32 recency;
+    };
+
+    const u64 start = armGetSystemTick();
+
+    std::vector<ApplicationId> seen;
+    std::vector<ScanJob> jobs;
+
+    /* Iterate over installed applications, a batch of records at a time. */
     s32 offset=0, count=0;
-    NsApplicationRecord record;
-    while (R_SUCCEEDED(nsListApplicationRecord(&record, 1, offset++, &count)) && count != 0) {
-        /* Skip archived and downloading applications. */
-        if (record.type == NsApplicationRecordType_Archived || record.type == NsApplicationRecordType_Downloading)
-            continue;
+    this->records.resize(RecordBatchSize);
+    while (this->ipc.application_record++, R_SUCCEEDED(nsPoolListApplicationRecord(this->records.data(), this->records.size(), offset, &count)) && count != 0) {
+        offset += count;
 
-        const u64 application_id = record.application_id;
-        
-        const u32 installed = GetInstalledVersion(application_id);
-        const u32 available = GetAvailableVersion(application_id);
-        const u32 required = GetLaunchRequiredVersion(application_id);
+        for (const auto &record: std::span(this->records.data(), count)) {
+            /* Skip archived and downloading applications. */
+            if (record.type == NsApplicationRecordType_Archived || record.type == NsApplicationRecordType_Downloading)
+                continue;
 
-        /* Check if latest version is already installed. */
-        if (installed >= available && installed >= required)
-            continue;
+            const u64 application_id = record.application_id;
+            seen.push_back(application_id);
 
-        const auto app_name = GetApplicationName(application_id);
+            const auto cached = this->metadata_cache.Lookup(record);
 
-        this->log.appendf("Adding: %s, installed: %d, available: %d\n", app_name, installed, available);
+            /* Neither the record nor any version entry changed, the previous result still holds. */
+            if (cached != nullptr && known.contains(application_id) && !changed.contains(application_id)) {
+                auto control = this->control_cache.Peek(application_id);
+                this->metadata_cache.Store(record, cached->versions, control != nullptr ? std::move(control) : cached->control);
+                continue;
+            }
 
-        this->available[application_id] = { app_name, required > installed };
+            jobs.push_back({ .record = record, .cached = cached, .recency = static_cast<u32>(seen.size() - 1) });
+        }
+
+        /* A short batch means there are no more records. */
+        if (static_cast<size_t>(count) < this->records.size())
+            break;
     }
+
+    this->scan_total = jobs.size();
+
+    /* Evaluate titles in parallel, every worker with its own scratch buffer. */
+    std::vector<InstalledVersions> versions(jobs.size());
+    std::atomic<size_t> next_job = 0;
+    auto worker = [&] {
+        std::vector<NsApplicationContentMetaStatus> buffer;
+        for (size_t i; !this->scan_cancel && (i = next_job++) < jobs.size();) {
+            const auto &job = jobs[i];
+            const u64 application_id = job.record.application_id;
+
+            ScanResult result = { .application_id = application_id, .recency = job.recency };
+            if (job.cached != nullptr) {
+                result.versions = job.cached->versions;
+                if (job.cached->control != nullptr && this->control_cache.Peek(application_id) == nullptr)
+                    this->control_cache.Insert(application_id, job.cached->control);
+                this->ipc.metadata_cache_hits++;
+            } else {
+                result.versions = QueryInstalledVersions(application_id, buffer);
+            }
+
+            result.available = GetAvailableVersion(application_id);
+            result.required = GetLaunchRequiredVersion(application_id);
+
+            /* Only outdated titles are listed and need a name and size estimate. */
+            if (result.versions.patch < result.available || result.versions.patch < result.required) {
+                result.name = GetApplicationName(application_id);
+                EstimateUpdateSize(application_id, result.storage, result.required_space);
+            }
+
+            versions[i] = result.versions;
+
+            /* Publish right away so the list fills in while the scan is running. */
+            {
+                std::scoped_lock lk(this->scan_mutex);
+                this->pending.push_back(std::move(result));
+            }
+            this->scan_done++;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(this->scan_workers, jobs.size()); i++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &thread: workers)
+        thread.join();
+
+    const u64 elapsed_ms = armTicksToNs(armGetSystemTick() - start) / 1'000'000;
+
+    this->ScanLog("Scanned %d applications in %lums, evaluated %zu on %zu threads, IPC calls: records %u, meta status %u, required version %u\n",
+        offset, elapsed_ms, jobs.size(), workers.size() + 1,
+        this->ipc.application_record.load(), this->ipc.content_meta_status.load(), this->ipc.launch_required_version.load());
+    const auto manager_sessions = nsGetManagerSessionStats(), version_sessions = nsGetVersionSessionStats();
+    this->ScanLog("Session pools since launch: manager %u checkouts, %u waited %lums, version %u checkouts, %u waited %lums\n",
+        manager_sessions.checkouts, manager_sessions.contended, manager_sessions.wait_ns / 1'000'000,
+        version_sessions.checkouts, version_sessions.contended, version_sessions.wait_ns / 1'000'000);
+    this->ScanLog("Control data cache: %u hits, %u misses\n", this->control_cache.GetHits(), this->control_cache.GetMisses());
+    this->ScanLog("Metadata cache: %u of %zu evaluated applications unchanged\n", this->ipc.metadata_cache_hits.load(), jobs.size());
+
+    /* A cancelled scan didn't evaluate every job, the previous entries still stand for the rest. */
+    if (this->scan_cancel)
+        return seen;
+
+    for (size_t i = 0; i < jobs.size(); i++)
+        this->metadata_cache.Store(jobs[i].record, versions[i], this->control_cache.Peek(jobs[i].record.application_id));
+
+    /* Uninstalled applications drop out. The file is only rewritten if something changed. */
+    this->metadata_cache.Retain(seen);
+    if (this->metadata_cache.IsDirty() && !this->metadata_cache.Save())
+        this->ScanLog("Failed to write metadata cache\n");
+
+    return seen;
 }
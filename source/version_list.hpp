@@ -19,35 +19,144 @@
 #include <switch.h>
 #include <imgui.h>
 
+#include "control_cache.hpp"
+#include "metadata_cache.hpp"
+#include "update_queue.hpp"
+
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-using ApplicationId = u64;
+/* Number of IPC round trips made during the last scan. Updated by scan workers. */
+struct IpcCounters {
+    std::atomic<u32> application_record = 0;
+    std::atomic<u32> content_meta_status = 0;
+    std::atomic<u32> launch_required_version = 0;
+    std::atomic<u32> metadata_cache_hits = 0;
+
+    void Reset() noexcept {
+        this->application_record = 0;
+        this->content_meta_status = 0;
+        this->launch_required_version = 0;
+        this->metadata_cache_hits = 0;
+    }
+};
+
+/* Classification of one application, published by the scan as soon as it is known. */
+struct ScanResult {
+    ApplicationId application_id;
+    InstalledVersions versions;
+    u32 available, required;
+    u32 recency;
+    std::string name;
+    /* Where the update is expected to go and how much it needs there. */
+    NcmStorageId storage;
+    s64 required_space;
+};
+
+/* A title with an update available. */
+struct ListEntry {
+    std::string name;
+    /* Launch is blocked until the launch required version is installed. */
+    bool required;
+    /* Position in the application record list, which the system keeps sorted by last use. */
+    u32 recency;
+    u32 installed, available;
+    /* The system accepted an update request, the patch isn't installed yet. */
+    bool requested;
+    NcmStorageId storage;
+    s64 required_space;
+    /* Held back because the storage doesn't have room for it. */
+    bool deferred;
+};
 
 class VersionList {
   private:
     std::vector<AvmVersionListEntry> impl;
-    std::unordered_map<ApplicationId, std::pair<std::string, bool>> available;
+    std::vector<AvmRequiredVersionEntry> required_versions;
+    bool required_versions_loaded = false;
+    std::vector<NsApplicationRecord> records;
+    std::unordered_map<ApplicationId, InstalledVersions> installed;
+    std::unordered_map<ApplicationId, ListEntry> available;
+    std::vector<ApplicationId> plan;
+    bool plan_dirty = true;
     ApplicationId selected = 0;
     mutable ImGuiTextBuffer log;
+    mutable IpcCounters ipc;
+    mutable ControlDataCache control_cache{0x400000};
+    MetadataCache metadata_cache;
+
+    /* Background scan. Results are handed to the UI thread through pending. */
+    std::thread scan_thread;
+    std::atomic_bool scanning = false, scan_cancel = false;
+    std::atomic<u32> scan_done = 0, scan_total = 0;
+    bool rescan = false, rescan_download = false;
+    std::atomic_bool downloading = false;
+    u64 last_download_tick = 0;
+    std::mutex scan_mutex;
+    std::vector<ScanResult> pending;
+    std::vector<ApplicationId> scan_seen;
+    bool scan_finished = false;
+    std::string scan_log;
+    size_t scan_workers;
+
+    UpdateQueue updates;
+    bool bulk_update = false;
+    /* Journaled updates are resumed after the first scan that finishes online. */
+    bool resume_pending = true;
+    bool online = true;
 
   public:
-    VersionList();
+    /* Per title scan work is blocking IPC, spread it over one worker per usable core. */
+    static constexpr size_t DefaultScanWorkers = 3;
+
+    explicit VersionList(size_t scan_workers = DefaultScanWorkers);
+    ~VersionList();
+
+    void Refresh(bool download = false);
+    void Poll();
 
-    void Refresh();
+    bool IsScanning() const noexcept {
+        return this->scanning;
+    }
 
+    UpdateProgress GetUpdateProgress() const {
+        return this->updates.GetProgress();
+    }
+
+    InstalledVersions QueryInstalledVersions(ApplicationId application_id, std::vector<NsApplicationContentMetaStatus> &buffer) const noexcept;
     u32 GetInstalledVersion(ApplicationId application_id) const noexcept;
     u32 GetAvailableVersion(ApplicationId application_id) const noexcept;
     u32 GetLaunchRequiredVersion(ApplicationId application_id) const noexcept;
-    const char* GetApplicationName(ApplicationId application_id) const noexcept;
-    const u8* GetThumbnail(ApplicationId application_id) const noexcept;
-    bool UpdateSynchronous(ApplicationId application_id) const noexcept;
+    std::string GetApplicationName(ApplicationId application_id) const noexcept;
+    std::shared_ptr<const ControlData> GetThumbnail(ApplicationId application_id) noexcept;
+    const std::vector<ApplicationId> &GetUpdatePlan() noexcept;
+    bool QueueUpdate(ApplicationId application_id, bool bulk = false) noexcept;
+    void QueueUpdates(const std::vector<ApplicationId> &application_ids, bool bulk) noexcept;
     void UpdateAllApplications() noexcept;
+    void ResetAllLaunchVersions() noexcept;
+    bool HasRequiredVersions() const noexcept;
     
     void List(bool has_internet) noexcept;
     void Nuke() noexcept;
 
   private:
-    void UpdateAvailable();
+    void EstimateUpdateSize(ApplicationId application_id, NcmStorageId &storage, s64 &size) const noexcept;
+    bool ReserveSpace(ListEntry &entry, std::unordered_map<NcmStorageId, s64> &free_space) noexcept;
+    std::unordered_map<NcmStorageId, s64> QueryFreeSpace() const noexcept;
+    std::unordered_map<NcmStorageId, s64> QueryUpdateBudget() const noexcept;
+
+    void VerifyUpdate(UpdateJob &job) const noexcept;
+    void ApplyVerification(const UpdateJob &job);
+
+    void StartScan(bool download);
+    void Scan(const std::unordered_set<ApplicationId> &known, bool download);
+    void DownloadVersionList();
+    void WaitForStoredVersionList(u64 start);
+    std::vector<ApplicationId> ScanApplications(const std::unordered_set<ApplicationId> &known, const std::unordered_set<ApplicationId> &changed);
+    void ScanLog(const char *format, ...);
 };